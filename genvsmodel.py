@@ -37,11 +37,17 @@
 
 from datetime import datetime
 import argparse
+import hashlib
 import json
+import math
 import os
+import pickle
+import runpy
 import sys
 import textwrap
 
+VERSION = "1.1.0"
+
 parser = argparse.ArgumentParser(
         description="Generate VeriStand model boilerplate types/functions.",
         usage='%(prog)s [options] CONFIG')
@@ -54,6 +60,20 @@ parser.add_argument('-r', "--root", type=str, default=os.getcwd(),
         help="project root directory (default: current working directory)")
 parser.add_argument("-v", "--verbose", action='store_true',
         help="enable verbose output printed to stderr for debugging")
+parser.add_argument("--version", action='version',
+        version=f'%(prog)s {VERSION}')
+parser.add_argument("--cache", action=argparse.BooleanOptionalAction,
+        dest="cache", default=False,
+        help="cache the parsed and validated config on disk and reuse it " +
+        "while the config and the generator are unchanged")
+parser.add_argument("--cache-dir", type=str, default="", metavar='DIR',
+        dest="cache_dir",
+        help="directory to store cached configs in (default: " +
+        ".vsmodelgen-cache in the project root)")
+parser.add_argument("--depfile", type=str, default="", metavar='FILE',
+        help="write a make-compatible dependency file listing the files " +
+        "written as targets and every file read (the config, table scripts " +
+        "and their dependencies, and the generator) as prerequisites")
 
 outputargs = parser.add_argument_group('output options',
         'Options controlling the output of the generated source.')
@@ -80,10 +100,51 @@ genargs.add_argument(f'--src', action=argparse.BooleanOptionalAction,
         dest="gen_src", default=True, help="generate model source file")
 genargs.add_argument(f'--makefile', action=argparse.BooleanOptionalAction,
         dest="gen_makefile", default=False, help="generate makefile")
+genargs.add_argument(f'--cmake', action=argparse.BooleanOptionalAction,
+        dest="gen_cmake", default=False,
+        help="generate a CMake project (CMakeLists.txt, CMakePresets.json and " +
+        "an NI Linux RT toolchain file) along with a host benchmark driver")
 genargs.add_argument(f'--impl', action=argparse.BooleanOptionalAction,
         dest="gen_impl", default=False,
         help="generate boilerplate implementation of your model's required " +
         "functions (will NEVER override, even with --force specified)")
+genargs.add_argument(f'--log', action=argparse.BooleanOptionalAction,
+        dest="gen_log", default=False,
+        help="generate VSM_LOG() deferred-formatting binary logging macros " +
+        "and the vsmlog_decode.py decoder")
+genargs.add_argument('--log-ring', type=int, default=65536, metavar='WORDS',
+        dest="log_ring",
+        help="size of the binary log ring in 64-bit words (power of two, " +
+        "default: %(default)s)")
+genargs.add_argument('--log-file', type=str, default="", metavar='PATH',
+        dest="log_file",
+        help="binary log file written by the model, unless overridden by " +
+        "the VSMLOG_FILE environment variable (default: " +
+        "/tmp/<model_name>.vsmlog)")
+genargs.add_argument(f'--delta', action=argparse.BooleanOptionalAction,
+        dest="gen_delta", default=False,
+        help="generate a report-by-exception export of changed outports and " +
+        "signals (see the \"deadband\" channel option)")
+genargs.add_argument('--delta-ring', type=int, default=65536,
+        metavar='ENTRIES', dest="delta_ring",
+        help="size of the delta export ring in entries (power of two, " +
+        "default: %(default)s)")
+genargs.add_argument(f'--signal-mirror', action=argparse.BooleanOptionalAction,
+        dest="gen_mirror", default=False,
+        help="publish non-double signals through a contiguous double mirror " +
+        "updated after each step, so VeriStand probes them as doubles")
+genargs.add_argument(f'--startup-profile', action=argparse.BooleanOptionalAction,
+        dest="startup_profile", default=False,
+        help="time each phase of USER_Initialize() and publish the times as " +
+        "signals and a startup report")
+genargs.add_argument('--shards', type=int, default=1, metavar='N',
+        help="split the generated metadata tables and signal initialization " +
+        "code across N source files so they can be compiled in parallel " +
+        "(default: %(default)s)")
+genargs.add_argument('--heat', type=str, default="", metavar='FILE',
+        help="order the members of the signal and parameter structures " +
+        "hot-first from a heat file written by vsmbench -H, and move the " +
+        "channels it never saw accessed to the end of the structures")
 
 formatargs = parser.add_argument_group('formatting options',
         'Options controlling the formatting of the generated source.')
@@ -95,10 +156,11 @@ formatargs.add_argument("-w", "--indentwidth", metavar="N", type=int,
 
 makeargs = parser.add_argument_group('makefile options',
         textwrap.dedent("""
-            Options controlling the generated makefile (if enabled).
+            Options controlling the generated makefile and CMake project (if
+            enabled).
 
-            Generated build files (Makefile, build scripts, etc.) are stored in
-            the project root specified by -r.
+            Generated build files (Makefile, build scripts, CMake files, etc.)
+            are stored in the project root specified by -r.
 
             By default (if -S and -I are not specified), the output directory
             specified by -O (or the current working directory if -O is not
@@ -127,6 +189,14 @@ makeargs.add_argument('-V', "--veristand-version", type=int, default=2018,
 makeargs.add_argument('-B', "--bat", action='store_true', dest="gen_make_bat",
         help="generate build.bat script to use NI's toolchain to run the " +
         "generated makefile")
+makeargs.add_argument("--perf-ticks", type=int, default=10000, metavar='N',
+        dest="perf_ticks",
+        help="number of ticks run by the CMake perf-check target " +
+        "(default: %(default)s)")
+makeargs.add_argument("--perf-budget", type=float, default=0.0,
+        metavar='US', dest="perf_budget",
+        help="mean step time (in microseconds) above which the CMake " +
+        "perf-check target fails (default: the model baserate)")
 
 args = parser.parse_args()
 
@@ -154,76 +224,68 @@ outsrcfile = os.path.join(srcdir, args.outsrcfile)
 outheaderfile = os.path.join(srcdir, "model.h")
 outmakefile = os.path.join(args.root_dir, args.makefile_name)
 outmakebat = os.path.join(args.root_dir, "build.bat")
+outcmakelists = os.path.join(args.root_dir, "CMakeLists.txt")
+outcmakepresets = os.path.join(args.root_dir, "CMakePresets.json")
+outcmaketoolchain = os.path.join(args.root_dir, "cmake", "nilrt-toolchain.cmake")
+outhostbench = os.path.join(args.root_dir, "host", "vsmbench.c")
+outhosttrace = os.path.join(args.root_dir, "host", "vsmtrace.c")
+outlogdecoder = os.path.join(args.root_dir, "vsmlog_decode.py")
+
+if args.shards < 1:
+    Die("--shards must be at least 1")
+
+# additional source files holding the tables moved out of the model source
+# file when the output is sharded
+(outsrcstem, outsrcext) = os.path.splitext(outsrcfile)
+outshardfiles = [f'{outsrcstem}_shard{k}{outsrcext}'
+        for k in range(1, args.shards)]
+
+# (description, path) of every enabled output which may not be overwritten
+# without -f
+outputfiles = []
+if args.gen_src:
+    outputfiles += [("source file", outsrcfile)]
+    outputfiles += [("shard source file", f) for f in outshardfiles]
+if args.gen_header: outputfiles += [("header file", outheaderfile)]
+if args.gen_makefile: outputfiles += [("makefile", outmakefile)]
+if args.gen_make_bat: outputfiles += [("batch file", outmakebat)]
+if args.gen_cmake:
+    outputfiles += [("CMake project file", outcmakelists)]
+    outputfiles += [("CMake presets file", outcmakepresets)]
+    outputfiles += [("CMake toolchain file", outcmaketoolchain)]
+    outputfiles += [("host benchmark source file", outhostbench)]
+    outputfiles += [("host trace converter source file", outhosttrace)]
+if args.gen_log: outputfiles += [("log decoder", outlogdecoder)]
+
+if args.stdout and len(args.depfile) > 0:
+    Die("--depfile can't be used with --stdout")
 
 if not args.stdout:
-    if args.gen_src: Vprint("output source file path:", outsrcfile)
-    if args.gen_header: Vprint("output header file path:", outheaderfile)
-    if args.gen_makefile: Vprint("output makefile path:", outmakefile)
-    if args.gen_make_bat: Vprint("output batch file path:", outmakebat)
+    for (desc, path) in outputfiles:
+        Vprint(f"output {desc} path:", path)
 
     if not args.force:
-        if args.gen_src and os.path.exists(outsrcfile):
-            Eprint(f"output file {outsrcfile} exists, not overwriting")
-            Eprint("use -f to override this behavior")
-            exit(1)
-
-        if args.gen_header and os.path.exists(outheaderfile):
-            Eprint(f"output file {outheaderfile} exists, not overwriting")
-            Eprint("use -f to override this behavior")
-            exit(1)
-
-        if args.gen_makefile and os.path.exists(outmakefile):
-            Eprint(f"output file {outmakefile} exists, not overwriting")
-            Eprint("use -f to override this behavior")
-            exit(1)
-        if args.gen_make_bat and os.path.exists(outmakebat):
-            Eprint(f"output file {outmakebat} exists, not overwriting")
-            Eprint("use -f to override this behavior")
-            exit(1)
-
+        for (_, path) in outputfiles:
+            if os.path.exists(path):
+                Eprint(f"output file {path} exists, not overwriting")
+                Eprint("use -f to override this behavior")
+                exit(1)
     else:
-        if args.gen_src and os.path.exists(outsrcfile):
-            print(f"{outsrcfile} exists and will be overwritten (-f)")
-
-        if args.gen_header and os.path.exists(outheaderfile):
-            print(f"{outheaderfile} exists and will be overwritten (-f)")
-
-        if args.gen_makefile and os.path.exists(outmakefile):
-            print(f"{outmakefile} exists and will be overwritten (-f)")
-
-        if args.gen_make_bat and os.path.exists(outmakebat):
-            print(f"{outmakebat} exists and will be overwritten (-f)")
+        for (_, path) in outputfiles:
+            if os.path.exists(path):
+                print(f"{path} exists and will be overwritten (-f)")
 else:
     Vprint("output will be written to stdout")
 
 
-# load config from JSON file
-config = json.load(args.config)
-
-if not "name" in config:
-    Die("config does not define a model name")
-else:
-    if not str(config["name"]).isidentifier():
-        Die("model name is not a valid identifier")
-
-if not "builder" in config:
-    Die("config does not define a model builder")
-if not "baserate" in config:
-    Die("config does not define a model baserate")
-
-Vprint(f'model name: {config["name"]}')
-Vprint(f'model builder: {config["builder"]}')
-Vprint(f'model baserate: {config["baserate"]}')
-
-outimplfile = os.path.join(srcdir, config["name"] + '.c')
-if len(args.outimplfile) > 0:
-    outimplfile = os.path.join(srcdir, args.outimplfile)
+# read the config from the JSON file (it's parsed once the parsing functions
+# below are defined, unless it's cached)
+configtext = args.config.read()
 
-if args.gen_impl:
-    Vprint("output boilerplate file path:", outimplfile)
-    if os.path.exists(outimplfile):
-        print(f"{outimplfile} exists and will NOT be overwritten!")
-        args.gen_impl = False
+# files referenced by the config (e.g. table scripts) are relative to it
+configdir = os.getcwd()
+if args.config is not sys.stdin:
+    configdir = os.path.dirname(os.path.abspath(args.config.name))
 
 
 def Expand(msg: str) -> str:
@@ -240,6 +302,72 @@ def Expand(msg: str) -> str:
     else:
         return msg
 
+# files written by WriteOutput(), the targets listed in the --depfile
+writtenfiles = []
+
+def WriteOutput(path: str, contents: str):
+    """
+    Write generated contents to the given path (creating its directory if
+    needed), or to stdout if -s was specified.
+
+    :param path: the path of the output file
+    :param contents: the generated contents (without a trailing newline)
+
+    """
+    linecount = len(contents.splitlines())
+    if args.stdout:
+        print(contents, file=sys.stdout)
+    else:
+        outdir = os.path.dirname(path)
+        if len(outdir) > 0 and not os.path.isdir(outdir):
+            os.makedirs(outdir)
+        print(contents, file=open(path, 'w'))
+        print(f"wrote {linecount} lines to {path}")
+        writtenfiles.append(path)
+
+def DepfilePath(path: str) -> str:
+    """
+    Format a path for a make-style dependency file: relative to the current
+    directory (where make and Ninja run the generator) unless it's outside of
+    it, with spaces, '#', and '$' escaped.
+
+    """
+    path = os.path.abspath(path)
+    try:
+        rel = os.path.relpath(path)
+        if rel != os.pardir and not rel.startswith(os.pardir + os.sep):
+            path = rel
+    except ValueError:
+        # on another drive than the current directory, so keep it absolute
+        pass
+    return path.replace('\\', '/').replace(' ', '\\ ').replace('#', '\\#') \
+            .replace('$', '$$')
+
+def WriteDepfile(path: str, inputs: list):
+    """
+    Write the --depfile: every file written by this run depends on every file
+    read by it.
+
+    :param path: the path of the dependency file
+    :param inputs: the paths of the files read
+
+    """
+    targets = [DepfilePath(p) for p in dict.fromkeys(writtenfiles)]
+    prereqs = [DepfilePath(p) for p in dict.fromkeys(inputs)]
+    if len(targets) == 0:
+        Warn("no files were written, not writing a depfile")
+        return
+
+    contents = ' \\\n  '.join(targets) + ': \\\n  ' + \
+            ' \\\n  '.join(prereqs) + '\n'
+    outdir = os.path.dirname(path)
+    if len(outdir) > 0 and not os.path.isdir(outdir):
+        os.makedirs(outdir)
+    with open(path, 'w') as f:
+        f.write(contents)
+    Vprint(f"wrote depfile {path} ({len(targets)} targets, " +
+            f"{len(prereqs)} prerequisites)")
+
 def GetCategoryAndName(channel: str) -> (str, str):
     """
     Parse the name of an inport, outport, signal, or parameter into a category
@@ -268,7 +396,7 @@ def GetCategoryAndName(channel: str) -> (str, str):
         else:
             Die(f"'{channel}': names cannot contain more than one '.'")
 
-def ParseChannels(channels, desc=False, types=False) -> dict:
+def ParseChannels(channels, desc=False, types=False, attrs=()) -> dict:
     """
     Parse channels (inports, outports, signals, parameters) from the
     JSON config data.
@@ -279,9 +407,13 @@ def ParseChannels(channels, desc=False, types=False) -> dict:
     signals) (Default value = False)
     :param types: whether or not this channel type has a type field (i.e.
     signals and parameters) (Default value = False)
+    :param attrs: names of optional feature attributes (e.g. "stats") this
+    channel type may have, which are copied as-is and validated by the
+    feature (Default value = ())
 
     :returns: a dictionary mapping categories to lists of objects containing
-    name, dimX>=1, dimY>=1, and optionally a description and a type
+    name, dimX>=1, dimY>=1, and optionally a description, a type, and any
+    feature attributes
 
     """
     outdata = {}
@@ -293,6 +425,7 @@ def ParseChannels(channels, desc=False, types=False) -> dict:
         name = None
         description = None
         datatype = "double"
+        features = {}
 
         if isinstance(channel, dict):
             if "name" in channel:
@@ -323,6 +456,10 @@ def ParseChannels(channels, desc=False, types=False) -> dict:
                 Die(f"{channel['name']}: dimX cannot be less than 1")
             if dimY < 1:
                 Die(f"{channel['name']}: dimY cannot be less than 1")
+
+            for attr in attrs:
+                if attr in channel:
+                    features[attr] = channel[attr]
         elif isinstance(channel, str):
             (cat, name) = GetCategoryAndName(channel)
 
@@ -338,18 +475,24 @@ def ParseChannels(channels, desc=False, types=False) -> dict:
                 chandata["description"] = description
             if types:
                 chandata["type"] = datatype
+            chandata.update(features)
             if not cat in outdata:
                 outdata[cat] = []
             outdata[cat] += [chandata]
 
     return outdata
 
+# optional feature attributes of inports/outports and signals
+PORT_ATTRS = ("stats", "envelope", "deadband", "history", "spectrum", "poly")
+SIGNAL_ATTRS = ("stats", "envelope", "deadband", "alias", "history",
+        "spectrum", "lazy")
+
 def ParsePorts(ports) -> dict:
     """
     Wraps around ParseChannels() to parse inports or outports.
 
     """
-    return ParseChannels(ports, types=False, desc=False)
+    return ParseChannels(ports, types=False, desc=False, attrs=PORT_ATTRS)
 
 def ParseParameters(params) -> dict:
     """
@@ -363,9 +506,162 @@ def ParseSignals(signals) -> dict:
     Wraps around ParseChannels() to parse signals.
 
     """
-    return ParseChannels(signals, desc=True, types=True)
+    return ParseChannels(signals, desc=True, types=True, attrs=SIGNAL_ATTRS)
+
+def ChannelMember(category: str, channel) -> str:
+    """
+    Get the member designator of a channel within its structure (e.g. "name"
+    or "category.name").
+
+    :param category: the category of the channel
+    :param channel: the channel object
+    :type channel: dict
+
+    """
+    if category == ":default":
+        return channel["name"]
+    if "replica" in channel:
+        return f'{category}.{channel["name"]}[{channel["replica"]}]'
+    return f'{category}.{channel["name"]}'
+
+def ChannelExpr(kind: str, category: str, channel) -> str:
+    """
+    Get a C expression referring to a channel's storage from within
+    USER_TakeOneStep() (or a function with the same local variables).
+
+    :param kind: "inport", "outport", "signal", or "parameter"
+    :param category: the category of the channel
+    :param channel: the channel object
+    :type channel: dict
+
+    """
+    member = ChannelMember(category, channel)
+    if kind == "inport":
+        return f'inports->{member}'
+    elif kind == "outport":
+        return f'outports->{member}'
+    elif kind == "signal":
+        return f'rtSignal.{member}'
+    else:
+        return f'readParam.{member}'
+
+def ChannelPath(category: str, channel) -> str:
+    """
+    Get the name of a channel as it's shown in VeriStand, relative to the
+    model (e.g. "category/name").
+
+    """
+    if category == ":default":
+        return channel["name"]
+    if "replica" in channel:
+        return f'{category}[{channel["replica"]}]/{channel["name"]}'
+    return f'{category}/{channel["name"]}'
+
+def CountMembers(valuedata) -> int:
+    """
+    Count the channels stored in a structure, i.e. not counting signals with
+    an address of their own.
+
+    """
+    count = 0
+    for cat in valuedata:
+        count += len([v for v in valuedata[cat] if not "addr" in v])
+    return count
+
+def LoadHeat(path: str) -> dict:
+    """
+    Read a heat file written by vsmbench -H, which counts the reads and writes
+    of each signal and parameter while the model steps.
+
+    :param path: the path of the heat file
+
+    :returns: a dict mapping ("signal" or "parameter", channel path) to the
+    number of accesses counted
+
+    """
+    try:
+        with open(path, 'r') as f:
+            data = json.load(f)
+    except (OSError, ValueError) as e:
+        Die(f"failed to read heat file {path}: {e}")
+    if not isinstance(data, dict) or not isinstance(data.get("channels"), list):
+        Die(f"{path} is not a heat file")
+
+    counts = {}
+    for entry in data["channels"]:
+        try:
+            key = (str(entry["kind"]), str(entry["path"]))
+            counts[key] = counts.get(key, 0) + int(entry["reads"]) + \
+                    int(entry["writes"])
+        except (KeyError, TypeError, ValueError):
+            Die(f"{path}: malformed channel entry {entry}")
+    return counts
+
+def ChannelLayout(valuedata, kind=None) -> list:
+    """
+    Get the order of the members of a channels structure (see
+    FmtChannelsStruct()). Without a heat file (see LoadHeat()), or for ports,
+    the members are in config order.
+
+    With a heat file, signals and parameters are ordered hot-first by the
+    number of accesses counted: channels in the default category and whole
+    categories are sorted by their accesses (a category can't be split, so
+    its members are sorted within it). Channels and categories which were
+    never accessed come last, starting on a new cache line, so the hot ones
+    are packed into as few cache lines as possible.
+
+    :param valuedata: the channels
+    :type valuedata: dict
+    :param kind: "signal" or "parameter" to use the heat file, or None
+
+    :returns: a list of (category, members, cold) tuples, where cold is True
+    for the block which starts the cold storage
+
+    """
+    blocks = []
+    for cat in valuedata:
+        # signals with an address of their own (see FmtSignalInit()) aren't
+        # stored in the structure, and each member of a template is one array
+        # covering all of its replicas
+        members = [v for v in valuedata[cat]
+                if not "addr" in v and v.get("replica", 0) == 0]
+        if len(members) > 0:
+            blocks += [(cat, members)]
+    if heat is None or kind is None:
+        return [(cat, members, False) for (cat, members) in blocks]
+
+    # accesses of each member, summed over the replicas of templates
+    counts = {}
+    for cat in valuedata:
+        for v in valuedata[cat]:
+            key = (cat, v["name"])
+            counts[key] = counts.get(key, 0) + \
+                    heat.get((kind, ChannelPath(cat, v)), 0)
+
+    items = []
+    for (cat, members) in blocks:
+        members = sorted(members, key=lambda v: -counts[(cat, v["name"])])
+        if cat == ":default":
+            items += [(counts[(cat, v["name"])], cat, [v]) for v in members]
+        else:
+            items += [(sum([counts[(cat, v["name"])] for v in members]), cat,
+                members)]
+    items.sort(key=lambda item: -item[0])
+
+    layout = []
+    coldstart = False
+    for (accesses, cat, members) in items:
+        cold = accesses == 0 and not coldstart and len(layout) > 0
+        coldstart = coldstart or accesses == 0
+        if not cold and len(layout) > 0 and cat == ":default" and \
+                layout[-1][0] == ":default":
+            layout[-1][1].extend(members)
+        else:
+            layout += [(cat, list(members), cold)]
+    return layout
 
-def FmtChannelsStruct(valuedata, structname: str, types=False) -> str:
+def FmtChannelsStruct(valuedata, structname: str, types=False,
+        layout=None) -> str:
     """
     Format a dict of channels (inports, outports, signals, parameters)
     as returned by ParseChannels() into a C structure. This will be in the
@@ -385,10 +681,15 @@ def FmtChannelsStruct(valuedata, structname: str, types=False) -> str:
     C identifier)
     :param types: whether or not to expect a type field in the definition for
     each value
+    :param layout: the order of the members as returned by ChannelLayout()
+    (default: config order)
 
     :returns: a string containing the struct definition
 
     """
+    if layout is None:
+        layout = ChannelLayout(valuedata)
+
     outstr = f'typedef struct {structname} {{\n'
 
     # add dummy member for empty parameters structs, since the struct must exist
@@ -398,8 +699,12 @@ def FmtChannelsStruct(valuedata, structname: str, types=False) -> str:
             outstr += '\t/* Empty structures are invalid in C */\n'
             outstr += '\tint dummy_param_;\n'
 
-    for cat in valuedata:
-        indentlevel = 1
+    for (cat, members, cold) in layout:
+        # the cold storage starts on a new cache line
+        align = ''
+        if cold:
+            outstr += '\t/* channels never accessed while profiling */\n'
+            align = ' __attribute__((aligned(64)))'
 
         if cat == ":default":
             indentlevel = 1
@@ -407,19 +712,24 @@ def FmtChannelsStruct(valuedata, structname: str, types=False) -> str:
             indentlevel = 2
             outstr += f'\tstruct {structname}_{cat} {{\n'
 
-        for valdef in valuedata[cat]:
+        for valdef in members:
             datatype = "double"
             if types and "type" in valdef:
                 datatype = valdef["type"]
             outstr += ("\t" * indentlevel) + f'{datatype} {valdef["name"]}'
+            if "replicas" in valdef:
+                outstr += f'[{valdef["replicas"]}]'
             if valdef["dimX"] > 1 or valdef["dimY"] > 1:
                 outstr += f'[{valdef["dimX"]}]'
             if valdef["dimY"] > 1:
                 outstr += f'[{valdef["dimY"]}]'
+            if indentlevel == 1:
+                outstr += align
+                align = ''
             outstr += ';\n'
 
         if indentlevel == 2:
-            outstr += f'\t}} {cat};\n'
+            outstr += f'\t}} {cat}{align};\n'
 
     outstr += f"}} {structname};\n"
     return outstr
@@ -438,14 +748,40 @@ def FmtParametersStruct(params) -> str:
     Format a struct for parameters using FmtChannelsStruct().
 
     """
-    return FmtChannelsStruct(params, "Parameters", types=True)
+    return FmtChannelsStruct(params, "Parameters", types=True,
+            layout=ChannelLayout(params, "parameter"))
 
 def FmtSignalsStruct(signals) -> str:
     """
     Format a struct for signals using FmtChannelsStruct().
 
     """
-    return FmtChannelsStruct(signals, "Signals", types=True)
+    return FmtChannelsStruct(signals, "Signals", types=True,
+            layout=ChannelLayout(signals, "signal"))
+
+# table definitions (and their weights) moved out of the model source file when
+# the output is sharded; see ShardTable()
+shardtables = []
+
+def ShardTable(decl: str, defn: str, weight: int) -> str:
+    """
+    Place the definition of a generated metadata table. Without sharding, the
+    definition is returned as-is. Otherwise, the definition is queued to be
+    written to one of the shard source files and its extern declaration is
+    returned in its place.
+
+    :param decl: the extern declaration of the table (ending with a newline)
+    :param defn: the full definition of the table (ending with a newline)
+    :param weight: the approximate compile cost of the table (entry count)
+
+    :returns: the string to place in the model source file
+
+    """
+    if args.shards <= 1:
+        return defn
+
+    shardtables.append((decl, defn, weight))
+    return decl
 
 def FmtExtIO(port, category: str, is_input: bool) -> str:
     """
@@ -460,10 +796,10 @@ def FmtExtIO(port, category: str, is_input: bool) -> str:
     :returns: a string containing the generated ExtIO struct
 
     """
-    catfield = category + '/' if category != ":default" else ""
     dirfield = 0 if is_input else 1
     dims = f'{port["dimX"]}, {port["dimY"]}'
-    return f'{{0, "{catfield}{port["name"]}", 0, {dirfield}, 1, {dims}}}'
+    path = ChannelPath(category, port)
+    return f'{{0, "{path}", 0, {dirfield}, 1, {dims}}}'
 
 def FmtExtIOList(inports, outports) -> str:
     """
@@ -492,24 +828,28 @@ def FmtExtIOList(inports, outports) -> str:
     outstr += f'int32_t OutportSize = {outportcount};\n'
     outstr += 'int32_t ExtIOSize DataSection(".NIVS.extlistsize") = '
     outstr += f'{inportcount + outportcount};\n'
-    outstr += f'NI_ExternalIO rtIOAttribs[] DataSection(".NIVS.extlist") = {{\n'
+
+    table = f'NI_ExternalIO rtIOAttribs[] DataSection(".NIVS.extlist") = {{\n'
 
     if inportcount > 0:
-        outstr += f'\t/* Inports */\n'
+        table += f'\t/* Inports */\n'
         for cat in inports:
             for port in inports[cat]:
-                outstr += f'\t{FmtExtIO(port, cat, True)},\n'
-        outstr += '\n'
+                table += f'\t{FmtExtIO(port, cat, True)},\n'
+        table += '\n'
 
     if outportcount > 0:
-        outstr += f'\t/* Outports */\n'
+        table += f'\t/* Outports */\n'
         for cat in outports:
             for port in outports[cat]:
-                outstr += f'\t{FmtExtIO(port, cat, False)},\n'
-        outstr += '\n'
+                table += f'\t{FmtExtIO(port, cat, False)},\n'
+        table += '\n'
 
-    outstr += f'\t/* Terminate list */\n'
-    outstr += f'\t{{-1, NULL, 0, 0, 0, 0, 0}},\n}};\n'
+    table += f'\t/* Terminate list */\n'
+    table += f'\t{{-1, NULL, 0, 0, 0, 0, 0}},\n}};\n'
+
+    outstr += ShardTable('extern NI_ExternalIO rtIOAttribs[];\n', table,
+            inportcount + outportcount)
 
     return outstr
 
@@ -527,9 +867,8 @@ def FmtParamAttribs(param, category: str, offset=0) -> str:
     into the array for VeriStand
 
     """
-    catfield = category + '/' if category != ":default" else ""
-    namefield = str(config["name"]) + '/' + catfield + param['name']
-    structoffset = f'offsetof(Parameters, {param["name"]})'
+    namefield = str(config["name"]) + '/' + ChannelPath(category, param)
+    structoffset = f'offsetof(Parameters, {ChannelMember(category, param)})'
     typefield = 'rtDBL' if param["type"] == "double" else 'rtINT'
     dim = param["dimX"] * param["dimY"]
     return '{{0, "{}", {}, {}, {}, 2, {}, 0}}'.format(
@@ -561,46 +900,46 @@ def FmtParamList(params) -> str:
         outstr += 'NI_Parameter rtParamAttribs[1] '
         outstr += 'DataSection(".NIVS.paramlist");\n'
         outstr += 'int32_t ParamDimList[1] DataSection(".NIVS.paramdimlist");\n'
-        outstr += 'Parameters initParams DataSection(".NIVS.defaultparams");\n'
+        outstr += FmtInitParams()
         outstr += 'ParamSizeWidth Parameters_sizes[1] '
         outstr += 'DataSection(".NIVS.defaultparamsizes");\n'
     else:
-        outstr += 'NI_Parameter rtParamAttribs[] DataSection(".NIVS.paramlist")'
-        outstr += ' = {\n'
+        table = 'NI_Parameter rtParamAttribs[] DataSection(".NIVS.paramlist")'
+        table += ' = {\n'
         offset = 0
         for cat in params:
             for param in params[cat]:
-                outstr += f'\t{FmtParamAttribs(param, cat, offset)},\n'
+                table += f'\t{FmtParamAttribs(param, cat, offset)},\n'
                 offset += 2
-        outstr += '};\n'
+        table += '};\n'
+        outstr += ShardTable('extern NI_Parameter rtParamAttribs[];\n', table,
+                paramcount)
 
-        outstr += 'int32_t ParamDimList[] DataSection(".NIVS.paramdimlist")'
-        outstr += ' = {\n'
+        table = 'int32_t ParamDimList[] DataSection(".NIVS.paramdimlist")'
+        table += ' = {\n'
         for cat in params:
             for param in params[cat]:
-                outstr += f'\t{param["dimX"]:>2}, {param["dimY"]:>2}, '
-                if cat != ':default':
-                    outstr += f'/* {cat}.{param["name"]} */\n'
-                else:
-                    outstr += f'/* {param["name"]} */\n'
-        outstr += '};\n'
+                table += f'\t{param["dimX"]:>2}, {param["dimY"]:>2}, '
+                table += f'/* {ChannelMember(cat, param)} */\n'
+        table += '};\n'
+        outstr += ShardTable('extern int32_t ParamDimList[];\n', table,
+                paramcount)
 
         outstr += f'/* Set default parameter values here */\n'
-        outstr += 'Parameters initParams DataSection(".NIVS.defaultparams");\n'
+        outstr += FmtInitParams()
 
-        outstr += 'ParamSizeWidth Parameters_sizes[] '
-        outstr += 'DataSection(".NIVS.defaultparamsizes") = {\n'
-        outstr += f'\t{{sizeof(Parameters), 0, 0}},\n'
+        table = 'ParamSizeWidth Parameters_sizes[] '
+        table += 'DataSection(".NIVS.defaultparamsizes") = {\n'
+        table += f'\t{{sizeof(Parameters), 0, 0}},\n'
         for cat in params:
             for param in params[cat]:
                 ptype = 'rtDBL' if param["type"] == "double" else 'rtINT'
                 dim = param["dimX"] * param["dimY"]
-                outstr += f'\t{{sizeof({param["type"]}), {dim}, {ptype}}}, '
-                if cat != ':default':
-                    outstr += f'/* {cat}.{param["name"]} */\n'
-                else:
-                    outstr += f'/* {param["name"]} */\n'
-        outstr += '};\n'
+                table += f'\t{{sizeof({param["type"]}), {dim}, {ptype}}}, '
+                table += f'/* {ChannelMember(cat, param)} */\n'
+        table += '};\n'
+        outstr += ShardTable('extern ParamSizeWidth Parameters_sizes[];\n',
+                table, paramcount)
 
     return outstr
 
@@ -617,9 +956,10 @@ def FmtSignalAttribs(signal, category: str, offset=0) -> str:
     :returns a string containing the generated signal attributes structure
 
     """
-    catfield = category + '/' if category != ":default" else ""
-    namefield = str(config["name"]) + '/' + catfield + signal['name']
+    namefield = str(config["name"]) + '/' + ChannelPath(category, signal)
     typefield = 'rtDBL' if signal["type"] == "double" else 'rtINT'
+    if "mirror" in signal:
+        typefield = 'rtDBL'
     dim = signal["dimX"] * signal["dimY"]
     return '{{0, "{}", 0, "{}", 0, 0, {}, {}, 2, {}, 0}}'.format(
             namefield, signal["description"], typefield, dim, offset)
@@ -643,7 +983,7 @@ def FmtSignalList(signals) -> str:
 
     Vprint(f"found {signalcount} signals")
 
-    if signalcount > 0:
+    if CountMembers(signals) > 0:
         outstr += 'Signals rtSignal;\n\n'
 
     outstr += 'int32_t SignalSize DataSection(".NIVS.siglistsize") = '
@@ -653,27 +993,32 @@ def FmtSignalList(signals) -> str:
         outstr += 'NI_Signal rtSignalAttribs[1] DataSection(".NIVS.siglist");\n'
         outstr += 'int32_t SigDimList[1] DataSection(".NIVS.sigdimlist");\n'
     else:
-        outstr += 'NI_Signal rtSignalAttribs[] DataSection(".NIVS.siglist")'
-        outstr += ' = {\n'
+        table = 'NI_Signal rtSignalAttribs[] DataSection(".NIVS.siglist")'
+        table += ' = {\n'
         offset = 0
         for cat in signals:
             for sig in signals[cat]:
-                outstr += f'\t{FmtSignalAttribs(sig, cat, offset)},\n'
+                table += f'\t{FmtSignalAttribs(sig, cat, offset)},\n'
                 offset += 2
-        outstr += '};\n'
+        table += '};\n'
+        outstr += ShardTable('extern NI_Signal rtSignalAttribs[];\n', table,
+                signalcount)
 
-        outstr += 'int32_t SigDimList[] DataSection(".NIVS.sigdimlist") = {\n'
+        table = 'int32_t SigDimList[] DataSection(".NIVS.sigdimlist") = {\n'
         for cat in signals:
             for sig in signals[cat]:
-                outstr += f'\t{sig["dimX"]:>2}, {sig["dimY"]:>2}, '
-                if cat != ':default':
-                    outstr += f'/* {cat}.{sig["name"]} */\n'
-                else:
-                    outstr += f'/* {sig["name"]} */\n'
-        outstr += '};\n'
+                table += f'\t{sig["dimX"]:>2}, {sig["dimY"]:>2}, '
+                table += f'/* {ChannelMember(cat, sig)} */\n'
+        table += '};\n'
+        outstr += ShardTable('extern int32_t SigDimList[];\n', table,
+                signalcount)
 
     return outstr
 
+# signal initialization functions defined by the shard source files (shard k
+# defines the k-th function, shard 0 being the model source file itself)
+shardinits = []
+
 def FmtSignalInit(signals) -> str:
     """
     Generate the code used to configure pointers to signals in the
@@ -689,13 +1034,12 @@ def FmtSignalInit(signals) -> str:
     if len(signals) == 0:
         return ''
 
-    outstr = '\n'
-    outstr += '\t/* Populate pointers to signal values */\n'
+    lines = []
     i = 0
 
     for cat in signals:
         for sig in signals[cat]:
-            outstr += f'\trtSignalAttribs[{i}].addr = (uintptr_t)'
+            line = f'\trtSignalAttribs[{i}].addr = (uintptr_t)'
             prefix = ''
             if sig["dimX"] == 1 and sig["dimY"] == 1:
                 prefix = '&'
@@ -703,117 +1047,92 @@ def FmtSignalInit(signals) -> str:
                 prefix = ''
             elif sig["dimX"] > 1 and sig["dimY"] > 1:
                 prefix = '*'
-            catname = '' if cat == ':default' else '.' + cat
-            outstr += f'{prefix}rtSignal{catname}.{sig["name"]};\n'
+            if "addr" in sig:
+                line += f'({sig["addr"]});\n'
+            elif "mirror" in sig:
+                line += f'(vsm_mirror + {sig["mirror"]});\n'
+            else:
+                line += f'{prefix}rtSignal.{ChannelMember(cat, sig)};\n'
+            lines += [line]
             i += 1
 
-    return outstr
-
+    # the first chunk stays in USER_Initialize(), the rest are moved into
+    # functions defined by the shard source files
+    chunk = -(-len(lines) // args.shards)
 
-# data taken from the config
-inports = {}
-outports = {}
-parameters = {}
-signals = {}
-baserate = float(config["baserate"])
-if "inports" in config:
-    inports = ParsePorts(config["inports"])
-if "outports" in config:
-    outports = ParsePorts(config["outports"])
-if "parameters" in config:
-    parameters = ParseParameters(config["parameters"])
-if "signals" in config:
-    signals = ParseSignals(config["signals"])
+    outstr = '\n'
+    outstr += '\t/* Populate pointers to signal values */\n'
+    outstr += ''.join(lines[:chunk])
 
-# generate an include guard based on the name of the model
-incguard = f'{str(config["name"]).upper()}_MODEL_H'
+    for k in range(1, args.shards):
+        body = ''.join(lines[k * chunk:(k + 1) * chunk])
+        shardinits.append(f'void vsm_InitSignals{k}(void) {{\n{body}}}\n')
+        outstr += f'\tvsm_InitSignals{k}();\n'
 
-if args.gen_header:
-    Vprint(f"using {incguard} as model.h include guard")
+    return outstr
 
-# contents of the model.h file
-output_model_h = f'''
-/*
- * Auto-generated VeriStand model types for {config["name"]}.
- *
- * Generated {Timestamp()}
- *
- * You almost certainly do NOT want to edit this file, as it may be overwritten
- * at any time!
- */
+def FmtShardDecls(signals) -> str:
+    """
+    Generate the prototypes of the signal initialization functions defined by
+    the shard source files.
 
-#ifndef {incguard}
-#define {incguard}
+    :param signals: list of signals
+    :type signals: list
 
-#include <stdint.h>
+    :returns: the generated prototypes (empty if the output is not sharded)
 
-/* Parameters structure */
-{FmtParametersStruct(parameters)}
+    """
+    if args.shards <= 1 or len(signals) == 0:
+        return ''
 
-/* Parameters are defined by NI model interface code */
-/* Use readParam to access parameters */
-extern Parameters rtParameter[2];
-extern int32_t READSIDE;
-#define readParam rtParameter[READSIDE]
-'''
+    outstr = '/* Signal pointer initialization (defined in shard sources) */\n'
+    for k in range(1, args.shards):
+        outstr += f'void vsm_InitSignals{k}(void);\n'
 
-# add inports and outports only if applicable
-inportsstruct = f'''
-/* Inports structure */
-{FmtPortsStruct(inports, "Inports")}
-'''
-if len(inports) > 0:
-    output_model_h += inportsstruct
+    return outstr + '\n'
 
-outportsstruct = f'''
-/* Outports structure */
-{FmtPortsStruct(outports, "Outports")}
-'''
-if len(outports) > 0:
-    output_model_h += outportsstruct
+def FmtShards() -> list:
+    """
+    Distribute the tables queued by ShardTable() and the signal initialization
+    functions generated by FmtSignalInit() across the shard source files.
+    Shard k always receives the k-th initialization function; tables are then
+    placed largest-first into whichever shard source file has the least work
+    so far. The model source file (shard 0) only keeps the tables' extern
+    declarations, so every table is defined in exactly one shard.
 
-signalsstruct = f'''
-/* Signals structure */
-{FmtSignalsStruct(signals)}
+    Must be called after the model source has been generated.
 
-/* Model signals */
-extern Signals rtSignal;
-'''
-if len(signals) > 0:
-    output_model_h += signalsstruct
+    :returns: a list of the contents of each shard source file (not including
+    the model source file)
 
-output_model_h += f'''
-#ifdef __cplusplus
-extern "C" {{
-#endif /* __cplusplus */
+    """
+    if args.shards <= 1:
+        return []
 
-/* Your model code should define these functions. Return NI_OK or NI_ERROR. */
-int32_t {config["name"]}_Initialize(void);
-int32_t {config["name"]}_Start(void);'''
+    loads = [0] * args.shards
+    bodies = [''] * args.shards
 
-# model step function definition
-stepfuncdef = f'int32_t {config["name"]}_Step('
-if len(inports) > 0:
-    stepfuncdef += 'const Inports* inports, '
-if len(outports) > 0:
-    stepfuncdef += 'Outports* outports, '
-stepfuncdef += 'double timestamp)'
+    for (k, init) in enumerate(shardinits, start=1):
+        bodies[k] += '\n' + init
+        loads[k] += init.count('\n')
 
-output_model_h += f'''
-{stepfuncdef};
-int32_t {config["name"]}_Finalize(void);
+    # the model source file has already been generated with only the tables'
+    # declarations, so the definitions all go to the other shards
+    for (_, defn, weight) in sorted(shardtables, key=lambda t: -t[2]):
+        k = min(range(1, args.shards), key=lambda j: loads[j])
+        bodies[k] += '\n' + defn
+        loads[k] += weight
 
-#ifdef __cplusplus
-}} /* extern "C" */
-#endif /* __cplusplus */
+    Vprint(f"shard loads: {loads}")
 
-#endif /* {incguard} */
-'''
+    decls = ''.join([decl for (decl, _, _) in shardtables])
 
-# model source contents
-output_model_src = f'''
+    outputs = []
+    for k in range(1, args.shards):
+        outputs += [f'''
 /*
- * Auto-generated VeriStand model interface code for {config["name"]}.
+ * Auto-generated VeriStand model interface code for {config["name"]}
+ * (shard {k} of {os.path.basename(outsrcfile)}).
  *
  * Generated {Timestamp()}
  *
@@ -834,71 +1153,6114 @@ output_model_src = f'''
 extern "C" {{
 #endif /* __cplusplus */
 
-/* Model info */
-const char* USER_ModelName DataSection(".NIVS.compiledmodelname") =
-\t\t"{config["name"]}";
-const char* USER_Builder DataSection(".NIVS.builder") =
-\t\t"{config["builder"]}";
-
+/* Tables shared between shards */
+{decls}{bodies[k]}
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''']
 
-/* Model baserate */
-double USER_BaseRate = {baserate};
+    return outputs
 
-/* Model task configuration */
-NI_Task rtTaskAttribs DataSection(".NIVS.tasklist") = {{0, {baserate}, 0, 0}};
+def FmtHostBench() -> str:
+    """
+    Generate the host benchmark driver. The driver is independent of the model
+    configuration: it loads any model shared library built for the host with
+    dlopen() and discovers its ports, signals, and parameters from the NIVS
+    tables the library exports, just like VeriStand does.
 
+    :returns: a string containing the benchmark driver source
 
-/* Parameters */
-{FmtParamList(parameters)}
+    """
+    header = f'''
+/*
+ * Auto-generated host benchmark driver for VeriStand models.
+ *
+ * Generated {Timestamp()}
+ *
+ * You almost certainly do NOT want to edit this file, as it may be overwritten
+ * at any time!
+ */
+'''
 
-/* Signals */
-{FmtSignalList(signals)}
+    return header + r'''
+/*
+ * Runs a model shared library outside of VeriStand and reports the time taken
+ * by USER_Initialize() and by each call to USER_TakeOneStep(). With -a, runs
+ * two builds of a model in lockstep instead (see vsm_lockstep()).
+ *
+ * Usage: vsmbench [options] MODEL.so
+ *
+ *   -n TICKS   number of ticks to run (default: 10000)
+ *   -b US      fail (exit status 2) if the mean step time exceeds US
+ *              microseconds
+ *   -p         after each step, probe every signal element through
+ *              USER_GetValueByDataType() like VeriStand does, and report the
+ *              time taken
+ *   -r FILE    record a trace of every tick to FILE (see vsm_trace_open()),
+ *              which vsmtrace converts to columns or queries
+ *   -s         after each step, write every parameter element through
+ *              USER_SetValueByDataType() like VeriStand does (into the copy
+ *              of the parameters the model isn't reading), and report the
+ *              time taken
+ *   -a B.so    step B.so in lockstep with MODEL.so on identical inputs and
+ *              parameter writes, and report the first diverging channel and
+ *              the step time difference (exit status 3 if they diverge)
+ *   -w TICK:NAME[INDEX]=VALUE
+ *              write a parameter (path with or without the model name)
+ *              before the given tick (may be repeated)
+ *   -t TOL     relative tolerance for lockstep comparisons (default: 0)
+ *   -x NAME    don't compare the signal NAME (path with or without the model
+ *              name, or a category path ending in '/') in lockstep mode (may
+ *              be repeated)
+ *   -H FILE    count the reads and writes of each signal and parameter
+ *              instead of timing the model, and write them to the heat file
+ *              FILE for genvsmodel.py --heat (see vsm_heat()); the model
+ *              must be built without --signal-mirror
+ *   -j         print results as JSON
+ */
 
-/* Inports and outports */
-{FmtExtIOList(inports, outports)}
+#define _GNU_SOURCE
+#include "ni_modelframework.h"
 
-int32_t USER_SetValueByDataType(void* ptr, int32_t idx, double value,
-\t\tint32_t type) {{
-\tswitch (type) {{
-\t\tcase rtDBL:
-\t\t\t((double*)ptr)[idx] = (double)value;
-\t\t\treturn NI_OK;
-\t\tcase rtINT:
-\t\t\t((int32_t*)ptr)[idx] = (int32_t)value;
-\t\t\treturn NI_OK;
-\t}}
+#include <dlfcn.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <link.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+typedef int32_t (*vsm_voidfn)(void);
+typedef int32_t (*vsm_stepfn)(double*, double*, double);
+typedef double (*vsm_getfn)(void*, int32_t, int32_t);
+typedef int32_t (*vsm_setfn)(void*, int32_t, double, int32_t);
+
+/* A loaded model and the NIVS tables it exports */
+typedef struct vsm_model {
+	const char* path;
+	void* handle;
+	vsm_voidfn initialize;
+	vsm_voidfn start;
+	vsm_stepfn step;
+	vsm_voidfn finalize;
+	vsm_getfn getvalue;
+	vsm_setfn setvalue;
+	double baserate;
+	NI_ExternalIO* io;
+	int32_t iosize;
+	NI_Signal* signals;
+	int32_t sigsize;
+	NI_Parameter* params;
+	int32_t paramsize;
+	char* rtparams; /* rtParameter[2] */
+	const char* initparams;
+	int32_t paramstructsize;
+	int32_t inwidth;
+	int32_t outwidth;
+	double* in;
+	double* out;
+} vsm_model;
+
+static void* vsm_sym(vsm_model* m, const char* name, int required) {
+	void* sym = dlsym(m->handle, name);
+	if (sym == NULL && required) {
+		fprintf(stderr, "error: %s: missing symbol %s\n", m->path, name);
+		exit(1);
+	}
+	return sym;
+}
+
+static void vsm_load(vsm_model* m, const char* path) {
+	memset(m, 0, sizeof(*m));
+	m->path = path;
+
+	/* RTLD_LOCAL keeps the globals of several loaded models apart */
+	m->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (m->handle == NULL) {
+		fprintf(stderr, "error: %s\n", dlerror());
+		exit(1);
+	}
+
+	m->initialize = (vsm_voidfn)vsm_sym(m, "USER_Initialize", 1);
+	m->start = (vsm_voidfn)vsm_sym(m, "USER_ModelStart", 1);
+	m->step = (vsm_stepfn)vsm_sym(m, "USER_TakeOneStep", 1);
+	m->finalize = (vsm_voidfn)vsm_sym(m, "USER_Finalize", 1);
+	m->getvalue = (vsm_getfn)vsm_sym(m, "USER_GetValueByDataType", 1);
+	m->setvalue = (vsm_setfn)vsm_sym(m, "USER_SetValueByDataType", 1);
+	m->baserate = *(double*)vsm_sym(m, "USER_BaseRate", 1);
+
+	m->io = (NI_ExternalIO*)vsm_sym(m, "rtIOAttribs", 1);
+	m->iosize = *(int32_t*)vsm_sym(m, "ExtIOSize", 1);
+	m->signals = (NI_Signal*)vsm_sym(m, "rtSignalAttribs", 1);
+	m->sigsize = *(int32_t*)vsm_sym(m, "SignalSize", 1);
+	m->params = (NI_Parameter*)vsm_sym(m, "rtParamAttribs", 1);
+	m->paramsize = *(int32_t*)vsm_sym(m, "ParameterSize", 1);
+	m->rtparams = (char*)vsm_sym(m, "rtParameter", 1);
+	m->initparams = (const char*)vsm_sym(m, "initParams", 1);
+	if (m->paramsize > 0) {
+		m->paramstructsize =
+				((ParamSizeWidth*)vsm_sym(m, "Parameters_sizes", 1))[0].size;
+	}
+
+	for (int32_t i = 0; i < m->iosize; ++i) {
+		int32_t width = m->io[i].dimX * m->io[i].dimY;
+		if (m->io[i].type == 0) {
+			m->inwidth += width;
+		} else {
+			m->outwidth += width;
+		}
+	}
+
+	m->in = (double*)calloc((size_t)m->inwidth + 1, sizeof(double));
+	m->out = (double*)calloc((size_t)m->outwidth + 1, sizeof(double));
+	if (m->in == NULL || m->out == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		exit(1);
+	}
+}
+
+static int64_t vsm_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-\treturn NI_ERROR;
-}}
+/*
+ * Initialize the model the way the NI model framework does: both copies of
+ * the parameters start out as the default parameters.
+ */
+static int32_t vsm_init(vsm_model* m) {
+	if (m->paramstructsize > 0) {
+		memcpy(m->rtparams, m->initparams, (size_t)m->paramstructsize);
+		memcpy(m->rtparams + m->paramstructsize, m->initparams,
+				(size_t)m->paramstructsize);
+	}
+
+	int32_t ret = m->initialize();
+	if (ret == NI_OK) {
+		ret = m->start();
+	}
+	return ret;
+}
+
+/* Deterministic, cheap inputs: a slow sine wave with a per-port phase */
+static void vsm_fill_inputs(vsm_model* m, int64_t tick) {
+	double t = (double)tick * m->baserate;
+	for (int32_t i = 0; i < m->inwidth; ++i) {
+		m->in[i] = sin(t + (double)i);
+	}
+}
+
+/* Read every signal element the way VeriStand probes signals */
+static double vsm_probe(vsm_model* m) {
+	double sum = 0.0;
+	for (int32_t i = 0; i < m->sigsize; ++i) {
+		void* addr = (void*)m->signals[i].addr;
+		for (int32_t k = 0; k < m->signals[i].width; ++k) {
+			sum += m->getvalue(addr, k, m->signals[i].datatype);
+		}
+	}
+	return sum;
+}
 
-double USER_GetValueByDataType(void* ptr, int32_t idx, int32_t type) {{
-\tswitch (type) {{
-\t\tcase rtDBL:
-\t\t\treturn ((double*)ptr)[idx];
-\t\tcase rtINT:
-\t\t\treturn (double)(((int32_t*)ptr)[idx]);
-\t}}
+/*
+ * Write every parameter element the way VeriStand sets parameters. The writes
+ * go to the second copy of the parameters, which the model doesn't read
+ * (vsmbench never switches READSIDE), so they don't change its behavior.
+ */
+static void vsm_set(vsm_model* m) {
+	char* side = m->rtparams + (size_t)m->paramstructsize;
+	for (int32_t i = 0; i < m->paramsize; ++i) {
+		void* addr = side + m->params[i].addr;
+		for (int32_t k = 0; k < m->params[i].width; ++k) {
+			m->setvalue(addr, k, (double)k, m->params[i].datatype);
+		}
+	}
+}
+
+/* Ticks in each block of a trace */
+#define VSM_TRACE_BLOCK 4096
+
+/* A trace being recorded (see vsm_trace_open()) */
+typedef struct vsm_trace {
+	FILE* f;
+	int64_t width;    /* doubles per row */
+	int64_t rows;
+	double* row;
+	double* index;    /* summaries of the blocks so far */
+	int64_t capacity; /* blocks the index has room for */
+} vsm_trace;
+
+static void* vsm_trace_alloc(size_t size) {
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
 
-\t/* Return NaN on error */
-\tstatic const uint64_t nan = ~(uint64_t)0;
-\treturn *(const double*)&nan;
-}}
+/*
+ * Start recording a trace: one row of doubles per tick holding the model time,
+ * the Inports and Outports structures, and every signal element (in the order
+ * of the signal list). The rows are grouped into blocks of VSM_TRACE_BLOCK
+ * ticks, and an index summarizing each block lets readers skip the blocks
+ * which can't match a query. The file is laid out as (in native byte order):
+ *
+ *   char magic[8] = "VSMTRACE"
+ *   uint32_t version = 2
+ *   uint32_t channels
+ *   uint64_t width              (doubles per row)
+ *   uint32_t block              (rows per block)
+ *   uint32_t reserved
+ *   channels x {
+ *     uint32_t dimX, dimY
+ *     uint32_t length           (of the name, without a terminator)
+ *     char name[length]         ("time", "inports/...", "outports/...", or
+ *                               "signals/...")
+ *   }
+ *   zero padding to a multiple of 8 bytes
+ *   rows x double[width]
+ *   blocks x width x {min, max, first, last}
+ *   uint64_t blocks
+ *   uint64_t index              (file offset of the block summaries)
+ *   char magic[8] = "VSMINDEX"
+ *
+ * The index is written by vsm_trace_close(), so a trace cut short has rows but
+ * no index.
+ */
+static vsm_trace* vsm_trace_open(vsm_model* m, const char* path) {
+	const int32_t* sigdims = (const int32_t*)vsm_sym(m, "SigDimList", 0);
+	uint32_t head[4] = {2, (uint32_t)(1 + m->iosize + m->sigsize),
+			VSM_TRACE_BLOCK, 0};
+	uint64_t width = 1 + (uint64_t)m->inwidth + (uint64_t)m->outwidth;
+	long size = 32;
+	for (int32_t i = 0; i < m->sigsize; ++i) {
+		width += (uint64_t)m->signals[i].width;
+	}
+
+	vsm_trace* tr = (vsm_trace*)vsm_trace_alloc(sizeof(vsm_trace));
+	memset(tr, 0, sizeof(*tr));
+	tr->f = fopen(path, "wb");
+	if (tr->f == NULL) {
+		fprintf(stderr, "error: can't open %s\n", path);
+		exit(1);
+	}
+	tr->width = (int64_t)width;
+	tr->row = (double*)vsm_trace_alloc((size_t)width * sizeof(double));
+
+	fwrite("VSMTRACE", 1, 8, tr->f);
+	fwrite(head, sizeof(uint32_t), 2, tr->f);
+	fwrite(&width, sizeof(width), 1, tr->f);
+	fwrite(head + 2, sizeof(uint32_t), 2, tr->f);
+
+	for (uint32_t c = 0; c < head[1]; ++c) {
+		char name[1024];
+		uint32_t dims[3];
+		if (c == 0) {
+			snprintf(name, sizeof(name), "time");
+			dims[0] = 1;
+			dims[1] = 1;
+		} else if (c <= (uint32_t)m->iosize) {
+			/* the IO list has the inports and then the outports, in the order
+			 * of their structures */
+			NI_ExternalIO* io = &m->io[c - 1];
+			snprintf(name, sizeof(name), "%s/%s",
+					io->type == 0 ? "inports" : "outports", io->name);
+			dims[0] = (uint32_t)io->dimX;
+			dims[1] = (uint32_t)io->dimY;
+		} else {
+			/* signal paths start with the model name */
+			NI_Signal* sig = &m->signals[c - 1 - (uint32_t)m->iosize];
+			const char* rel = strchr(sig->blockname, '/');
+			snprintf(name, sizeof(name), "signals/%s",
+					rel != NULL ? rel + 1 : sig->blockname);
+			dims[0] = (uint32_t)sig->width;
+			dims[1] = 1;
+			if (sigdims != NULL && sig->numofdims == 2) {
+				dims[0] = (uint32_t)sigdims[sig->dimListOffset];
+				dims[1] = (uint32_t)sigdims[sig->dimListOffset + 1];
+			}
+		}
+		dims[2] = (uint32_t)strlen(name);
+		fwrite(dims, sizeof(uint32_t), 3, tr->f);
+		fwrite(name, 1, dims[2], tr->f);
+		size += 12 + (long)dims[2];
+	}
+
+	static const char zeros[8] = {0};
+	fwrite(zeros, 1, (size_t)((8 - size % 8) % 8), tr->f);
+	return tr;
+}
+
+/* Record one tick of a trace and update its block's summary */
+static void vsm_trace_row(vsm_model* m, vsm_trace* tr, double t) {
+	double* p = tr->row;
+	*p++ = t;
+	memcpy(p, m->in, (size_t)m->inwidth * sizeof(double));
+	p += m->inwidth;
+	memcpy(p, m->out, (size_t)m->outwidth * sizeof(double));
+	p += m->outwidth;
+	for (int32_t i = 0; i < m->sigsize; ++i) {
+		void* addr = (void*)m->signals[i].addr;
+		for (int32_t k = 0; k < m->signals[i].width; ++k) {
+			*p++ = m->getvalue(addr, k, m->signals[i].datatype);
+		}
+	}
+	fwrite(tr->row, sizeof(double), (size_t)tr->width, tr->f);
+
+	int64_t block = tr->rows / VSM_TRACE_BLOCK;
+	if (block >= tr->capacity) {
+		tr->capacity = tr->capacity > 0 ? tr->capacity * 2 : 64;
+		tr->index = (double*)realloc(tr->index, (size_t)tr->capacity *
+				(size_t)tr->width * 4 * sizeof(double));
+		if (tr->index == NULL) {
+			fprintf(stderr, "error: out of memory\n");
+			exit(1);
+		}
+	}
+
+	double* s = tr->index + block * tr->width * 4;
+	if (tr->rows % VSM_TRACE_BLOCK == 0) {
+		for (int64_t c = 0; c < tr->width; ++c, s += 4) {
+			s[0] = HUGE_VAL;
+			s[1] = -HUGE_VAL;
+			s[2] = tr->row[c];
+		}
+		s = tr->index + block * tr->width * 4;
+	}
+	for (int64_t c = 0; c < tr->width; ++c, s += 4) {
+		double v = tr->row[c];
+		s[0] = v < s[0] ? v : s[0];
+		s[1] = v > s[1] ? v : s[1];
+		s[3] = v;
+	}
+	++tr->rows;
+}
+
+/* Write a trace's index and close it; returns 0 on success */
+static int vsm_trace_close(vsm_trace* tr) {
+	uint64_t tail[2];
+	tail[0] = (uint64_t)((tr->rows + VSM_TRACE_BLOCK - 1) / VSM_TRACE_BLOCK);
+	tail[1] = (uint64_t)ftell(tr->f);
+
+	fwrite(tr->index, sizeof(double) * 4, (size_t)tail[0] * (size_t)tr->width,
+			tr->f);
+	fwrite(tail, sizeof(uint64_t), 2, tr->f);
+	fwrite("VSMINDEX", 1, 8, tr->f);
+
+	int ret = ferror(tr->f) ? -1 : 0;
+	if (fclose(tr->f) != 0) {
+		ret = -1;
+	}
+	free(tr->row);
+	free(tr->index);
+	free(tr);
+	return ret;
+}
+
+static int vsm_cmp_i64(const void* a, const void* b) {
+	int64_t x = *(const int64_t*)a;
+	int64_t y = *(const int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/* A parameter write applied to both models in lockstep mode (-w) */
+typedef struct vsm_write {
+	int64_t tick;
+	const char* name;
+	int32_t index;
+	double value;
+} vsm_write;
+
+#define VSM_MAX_WRITES 256
+#define VSM_MAX_EXCLUDES 256
+
+/* The generator's timing signals, which differ between any two runs and are
+ * never compared in lockstep mode */
+static const char* const vsm_timing[] = {
+	"delta/detect_ns",
+	"delta/detect_max_ns",
+	"startup/",
+};
+
+/* Data type IDs used by the generated models (rtDBL and rtINT) */
+#define VSM_DBL 0
+#define VSM_INT 1
+
+/* Parse TICK:NAME=VALUE or TICK:NAME[INDEX]=VALUE */
+static int vsm_parse_write(char* arg, vsm_write* w) {
+	char* colon = strchr(arg, ':');
+	char* eq = strrchr(arg, '=');
+	if (colon == NULL || eq == NULL || eq < colon) {
+		return 0;
+	}
+
+	*colon = '\0';
+	*eq = '\0';
+	w->tick = atoll(arg);
+	w->name = colon + 1;
+	w->value = atof(eq + 1);
+	w->index = 0;
+
+	/* an index after the last path separator selects a vector element */
+	char* bracket = strrchr(colon + 1, '[');
+	char* slash = strrchr(colon + 1, '/');
+	if (bracket != NULL && (slash == NULL || bracket > slash) &&
+			eq[-1] == ']') {
+		*bracket = '\0';
+		w->index = atoi(bracket + 1);
+	}
+	return 1;
+}
+
+/* Find a parameter by its path, with or without the leading model name */
+static NI_Parameter* vsm_find_param(vsm_model* m, const char* name) {
+	for (int32_t i = 0; i < m->paramsize; ++i) {
+		const char* path = m->params[i].paramname;
+		const char* rel = strchr(path, '/');
+		if (strcmp(path, name) == 0 ||
+				(rel != NULL && strcmp(rel + 1, name) == 0)) {
+			return &m->params[i];
+		}
+	}
+	return NULL;
+}
+
+/* Write a parameter element into both copies of the parameters */
+static void vsm_write_param(vsm_model* m, const vsm_write* w) {
+	NI_Parameter* p = vsm_find_param(m, w->name);
+	if (p == NULL || w->index < 0 || w->index >= p->width) {
+		fprintf(stderr, "error: %s: no parameter %s[%d]\n", m->path, w->name,
+				w->index);
+		exit(1);
+	}
+
+	for (int32_t side = 0; side < 2; ++side) {
+		char* addr = m->rtparams + (size_t)side * (size_t)m->paramstructsize +
+				p->addr;
+		if (p->datatype == VSM_DBL) {
+			((double*)addr)[w->index] = w->value;
+		} else {
+			((int32_t*)addr)[w->index] = (int32_t)w->value;
+		}
+	}
+}
+
+/* Values are equal if both are NaN or they're within a relative tolerance */
+static int vsm_same(double a, double b, double tol) {
+	if (a == b || (isnan(a) && isnan(b))) {
+		return 1;
+	}
+	return fabs(a - b) <= tol * fmax(1.0, fmax(fabs(a), fabs(b)));
+}
+
+/* Check if a path is a name, or is in a category given as a path ending in
+ * '/' */
+static int vsm_path_is(const char* path, const char* name) {
+	size_t len = strlen(name);
+	if (len > 0 && name[len - 1] == '/') {
+		return strncmp(path, name, len) == 0;
+	}
+	return strcmp(path, name) == 0;
+}
+
+/* Check if a signal path (with or without the leading model name) matches one
+ * of the given names (see vsm_path_is()) */
+static int vsm_match_path(const char* path, const char* const* names,
+		int32_t count) {
+	const char* rel = strchr(path, '/');
+	for (int32_t k = 0; k < count; ++k) {
+		if (vsm_path_is(path, names[k]) ||
+				(rel != NULL && vsm_path_is(rel + 1, names[k]))) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Signals of the model being sorted by vsm_sort_signals() */
+static NI_Signal* vsm_sortsigs;
+
+static int vsm_cmp_signal(const void* x, const void* y) {
+	return strcmp(vsm_sortsigs[*(const int32_t*)x].blockname,
+			vsm_sortsigs[*(const int32_t*)y].blockname);
+}
+
+/* Get the indices of a model's signals sorted by name */
+static int32_t* vsm_sort_signals(vsm_model* m) {
+	int32_t* order = (int32_t*)malloc(((size_t)m->sigsize + 1) *
+			sizeof(int32_t));
+	if (order == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		exit(1);
+	}
+	for (int32_t i = 0; i < m->sigsize; ++i) {
+		order[i] = i;
+	}
+	vsm_sortsigs = m->signals;
+	qsort(order, (size_t)m->sigsize, sizeof(int32_t), vsm_cmp_signal);
+	return order;
+}
+
+/* Find a signal by name using the order from vsm_sort_signals() */
+static int32_t vsm_find_signal(vsm_model* m, const int32_t* order,
+		const char* name) {
+	int32_t lo = 0;
+	int32_t hi = m->sigsize - 1;
+	while (lo <= hi) {
+		int32_t mid = lo + (hi - lo) / 2;
+		int c = strcmp(name, m->signals[order[mid]].blockname);
+		if (c == 0) {
+			return order[mid];
+		} else if (c < 0) {
+			hi = mid - 1;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return -1;
+}
+
+/* Describe the element of the external IO list (of one direction) at a width
+ * offset */
+static void vsm_io_name(vsm_model* m, int32_t type, int32_t offset,
+		char* buf, size_t size) {
+	for (int32_t i = 0; i < m->iosize; ++i) {
+		if (m->io[i].type != type) {
+			continue;
+		}
+		int32_t width = m->io[i].dimX * m->io[i].dimY;
+		if (offset < width) {
+			snprintf(buf, size, width > 1 ? "%s[%d]" : "%s", m->io[i].name,
+					offset);
+			return;
+		}
+		offset -= width;
+	}
+	snprintf(buf, size, "?");
+}
 
-int32_t USER_Initialize(void) {{{FmtSignalInit(signals)}
-\treturn {config["name"]}_Initialize();
-}}
+/*
+ * Step two models in lockstep on identical inputs and parameter writes,
+ * comparing their outports and the signals they have in common after each
+ * step (except the generator's timing signals and the excluded ones), and
+ * report the first divergence and the step time difference. Returns the exit
+ * status (3 if the models diverged).
+ */
+static int vsm_lockstep(vsm_model* a, vsm_model* b, int64_t ticks,
+		const vsm_write* writes, int32_t nwrites, const char* const* excludes,
+		int32_t nexcludes, double tol, int json) {
+	if (a->handle == b->handle) {
+		fprintf(stderr, "error: %s and %s are the same library (copy one of "
+				"them)\n", a->path, b->path);
+		return 1;
+	}
+	if (a->inwidth != b->inwidth || a->outwidth != b->outwidth) {
+		fprintf(stderr, "error: the models' inports or outports differ\n");
+		return 1;
+	}
+
+	/* match B's signals to A's by name */
+	int32_t* order = vsm_sort_signals(b);
+	int32_t* match = (int32_t*)malloc(((size_t)a->sigsize + 1) *
+			sizeof(int32_t));
+	if (match == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+
+	int32_t matched = 0;
+	int32_t excluded = 0;
+	for (int32_t i = 0; i < a->sigsize; ++i) {
+		const char* name = a->signals[i].blockname;
+		if (vsm_match_path(name, vsm_timing,
+					(int32_t)(sizeof(vsm_timing) / sizeof(vsm_timing[0]))) ||
+				vsm_match_path(name, excludes, nexcludes)) {
+			match[i] = -1;
+			++excluded;
+			continue;
+		}
+		match[i] = vsm_find_signal(b, order, name);
+		if (match[i] >= 0 && b->signals[match[i]].width != a->signals[i].width) {
+			match[i] = -1;
+		}
+		matched += match[i] >= 0;
+	}
+	free(order);
+
+	if (vsm_init(a) != NI_OK || vsm_init(b) != NI_OK) {
+		fprintf(stderr, "error: model initialization failed\n");
+		return 1;
+	}
+
+	int64_t ns[2] = {0, 0};
+	int64_t diverged = -1;
+	char where[512] = "";
+	double va = 0.0;
+	double vb = 0.0;
+
+	for (int64_t tick = 0; tick < ticks; ++tick) {
+		double t = (double)tick * a->baserate;
+		vsm_fill_inputs(a, tick);
+		memcpy(b->in, a->in, (size_t)a->inwidth * sizeof(double));
+		for (int32_t w = 0; w < nwrites; ++w) {
+			if (writes[w].tick == tick) {
+				vsm_write_param(a, &writes[w]);
+				vsm_write_param(b, &writes[w]);
+			}
+		}
+
+		/* alternate which model runs first so neither gets warmer caches */
+		for (int32_t k = 0; k < 2; ++k) {
+			int32_t which = (int32_t)((tick + k) & 1);
+			vsm_model* m = which == 0 ? a : b;
+			int64_t start = vsm_now_ns();
+			int32_t ret = m->step(m->in, m->out, t);
+			ns[which] += vsm_now_ns() - start;
+			if (ret != NI_OK) {
+				fprintf(stderr, "error: %s: step failed at tick %lld\n",
+						m->path, (long long)tick);
+				return 1;
+			}
+		}
+
+		if (diverged >= 0) {
+			continue;
+		}
+
+		for (int32_t i = 0; i < a->outwidth && diverged < 0; ++i) {
+			if (!vsm_same(a->out[i], b->out[i], tol)) {
+				diverged = tick;
+				vsm_io_name(a, 1, i, where, sizeof(where));
+				va = a->out[i];
+				vb = b->out[i];
+			}
+		}
+
+		for (int32_t i = 0; i < a->sigsize && diverged < 0; ++i) {
+			if (match[i] < 0) {
+				continue;
+			}
+			NI_Signal* sa = &a->signals[i];
+			NI_Signal* sb = &b->signals[match[i]];
+			for (int32_t k = 0; k < sa->width; ++k) {
+				double x = a->getvalue((void*)sa->addr, k, sa->datatype);
+				double y = b->getvalue((void*)sb->addr, k, sb->datatype);
+				if (!vsm_same(x, y, tol)) {
+					diverged = tick;
+					snprintf(where, sizeof(where),
+							sa->width > 1 ? "%s[%d]" : "%s", sa->blockname, k);
+					va = x;
+					vb = y;
+					break;
+				}
+			}
+		}
+	}
+
+	a->finalize();
+	b->finalize();
+	free(match);
+
+	double mean_a = (double)ns[0] / (double)ticks / 1e3;
+	double mean_b = (double)ns[1] / (double)ticks / 1e3;
+	double diff = mean_a > 0.0 ? (mean_b - mean_a) / mean_a * 100.0 : 0.0;
+
+	if (json) {
+		printf("{\"a\": \"%s\", \"b\": \"%s\", \"ticks\": %lld, "
+				"\"signals_compared\": %d, \"signals_unmatched\": %d, "
+				"\"signals_excluded\": %d, "
+				"\"step_mean_a_us\": %.3f, \"step_mean_b_us\": %.3f, "
+				"\"step_diff_pct\": %.2f, \"diverged\": %s",
+				a->path, b->path, (long long)ticks, matched,
+				a->sigsize - matched - excluded, excluded, mean_a, mean_b, diff,
+				diverged >= 0 ? "true" : "false");
+		if (diverged >= 0) {
+			printf(", \"tick\": %lld, \"channel\": \"%s\", \"a_value\": %.17g, "
+					"\"b_value\": %.17g", (long long)diverged, where, va, vb);
+		}
+		printf("}\n");
+	} else {
+		printf("model A:     %s\n", a->path);
+		printf("model B:     %s\n", b->path);
+		printf("ticks:       %lld\n", (long long)ticks);
+		printf("signals:     %d compared, %d only in A, %d excluded\n",
+				matched, a->sigsize - matched - excluded, excluded);
+		printf("step mean A: %.3f us\n", mean_a);
+		printf("step mean B: %.3f us (%+.2f%%)\n", mean_b, diff);
+		if (diverged >= 0) {
+			printf("diverged:    tick %lld, %s: A = %.17g, B = %.17g\n",
+					(long long)diverged, where, va, vb);
+		} else {
+			printf("diverged:    no\n");
+		}
+	}
+
+	return diverged >= 0 ? 3 : 0;
+}
 
-int32_t USER_ModelStart(void) {{
-\treturn {config["name"]}_Start();
-}}
+/*
+ * Heat profiling (-H): count the reads and writes of each signal and parameter
+ * stored in rtSignal and the parameters the model reads. The pages holding
+ * them are protected while the model steps, so every access faults. The fault
+ * handler counts the access against the channel at the faulting address,
+ * opens the page, and single-steps the access; the trap after it protects the
+ * page again. This is slow, so profile a few ticks. The counts are exact for
+ * single-threaded steps and approximate when the step runs worker threads
+ * (an access from one thread may slip through while another has the page
+ * open).
+ */
+#if defined(__linux__) && defined(__x86_64__)
+#define VSM_HEAT 1
+#endif
+
+#ifdef VSM_HEAT
+/* The storage of one channel */
+typedef struct vsm_span {
+	uintptr_t begin;
+	uintptr_t end;
+	int32_t channel; /* signals first, then parameters */
+} vsm_span;
+
+static vsm_span* vsm_spans;
+static int32_t vsm_nspans;
+static uint64_t* vsm_reads;
+static uint64_t* vsm_writes;
+static uint64_t vsm_other; /* accesses to the pages outside any channel */
+static uintptr_t vsm_watch[2][2]; /* page-aligned [begin, end) ranges */
+static uintptr_t vsm_pagesize;
+
+/* Pages opened by the fault handler, protected again by the trap */
+static __thread uintptr_t vsm_open[2];
+static __thread int vsm_nopen;
+
+static int vsm_cmp_span(const void* x, const void* y) {
+	uintptr_t a = ((const vsm_span*)x)->begin;
+	uintptr_t b = ((const vsm_span*)y)->begin;
+	return a < b ? -1 : a > b;
+}
+
+static int vsm_watched(uintptr_t addr) {
+	for (int k = 0; k < 2; ++k) {
+		if (addr >= vsm_watch[k][0] && addr < vsm_watch[k][1]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void vsm_protect(int prot) {
+	for (int k = 0; k < 2; ++k) {
+		if (vsm_watch[k][1] > vsm_watch[k][0]) {
+			mprotect((void*)vsm_watch[k][0], vsm_watch[k][1] - vsm_watch[k][0],
+					prot);
+		}
+	}
+}
+
+static void vsm_heat_fault(int sig, siginfo_t* info, void* context) {
+	ucontext_t* uc = (ucontext_t*)context;
+	uintptr_t addr = (uintptr_t)info->si_addr;
+	if (!vsm_watched(addr) || vsm_nopen == 2) {
+		/* a genuine crash: fault again with the default action */
+		signal(sig, SIG_DFL);
+		return;
+	}
+
+	int32_t lo = 0;
+	int32_t hi = vsm_nspans - 1;
+	int32_t found = -1;
+	while (lo <= hi) {
+		int32_t mid = lo + (hi - lo) / 2;
+		if (addr < vsm_spans[mid].begin) {
+			hi = mid - 1;
+		} else if (addr >= vsm_spans[mid].end) {
+			lo = mid + 1;
+		} else {
+			found = vsm_spans[mid].channel;
+			break;
+		}
+	}
+
+	/* bit 1 of the page fault error code is set for writes */
+	int write = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+	if (found < 0) {
+		__atomic_fetch_add(&vsm_other, 1, __ATOMIC_RELAXED);
+	} else {
+		__atomic_fetch_add(write ? &vsm_writes[found] : &vsm_reads[found], 1,
+				__ATOMIC_RELAXED);
+	}
+
+	/* an access may straddle two pages, so up to two can be open */
+	uintptr_t page = addr & ~(vsm_pagesize - 1);
+	mprotect((void*)page, vsm_pagesize, PROT_READ | PROT_WRITE);
+	vsm_open[vsm_nopen++] = page;
+	uc->uc_mcontext.gregs[REG_EFL] |= 0x100; /* trap flag */
+}
+
+static void vsm_heat_trap(int sig, siginfo_t* info, void* context) {
+	ucontext_t* uc = (ucontext_t*)context;
+	(void)sig;
+	(void)info;
+	while (vsm_nopen > 0) {
+		mprotect((void*)vsm_open[--vsm_nopen], vsm_pagesize, PROT_NONE);
+	}
+	uc->uc_mcontext.gregs[REG_EFL] &= ~0x100;
+}
+
+/* Add a span for each channel stored in [begin, end) */
+static void vsm_heat_spans(vsm_model* m, uintptr_t sigbegin, uintptr_t sigend) {
+	vsm_spans = (vsm_span*)calloc((size_t)m->sigsize + (size_t)m->paramsize +
+			1, sizeof(vsm_span));
+	if (vsm_spans == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		exit(1);
+	}
+
+	for (int32_t i = 0; i < m->sigsize; ++i) {
+		uintptr_t begin = m->signals[i].addr;
+		uintptr_t size = m->signals[i].datatype == VSM_DBL ? sizeof(double) :
+				sizeof(int32_t);
+		uintptr_t end = begin + size * (uintptr_t)m->signals[i].width;
+		if (begin >= sigbegin && end <= sigend) {
+			vsm_spans[vsm_nspans++] = (vsm_span){begin, end, i};
+		}
+	}
+	for (int32_t i = 0; i < m->paramsize; ++i) {
+		uintptr_t begin = (uintptr_t)m->rtparams + m->params[i].addr;
+		uintptr_t size = m->params[i].datatype == VSM_DBL ? sizeof(double) :
+				sizeof(int32_t);
+		uintptr_t end = begin + size * (uintptr_t)m->params[i].width;
+		vsm_spans[vsm_nspans++] = (vsm_span){begin, end, m->sigsize + i};
+	}
+	qsort(vsm_spans, (size_t)vsm_nspans, sizeof(vsm_span), vsm_cmp_span);
+}
+
+/* Widen [begin, end) to whole pages */
+static void vsm_heat_range(int k, uintptr_t begin, uintptr_t end) {
+	if (end > begin) {
+		vsm_watch[k][0] = begin & ~(vsm_pagesize - 1);
+		vsm_watch[k][1] = (end + vsm_pagesize - 1) & ~(vsm_pagesize - 1);
+	}
+}
+#endif
 
-int32_t USER_TakeOneStep(double* inData, double* outData, double timestamp) {{
+/*
+ * Step the model with its channel storage watched and write the access counts
+ * to a heat file, which genvsmodel.py --heat reads to order the members of
+ * the signal and parameter structures. The file is JSON:
+ *
+ *   {"model": ..., "ticks": ..., "other": ACCESSES, "channels": [
+ *     {"kind": "signal" or "parameter", "path": PATH, "reads": N,
+ *      "writes": N}, ...]}
+ *
+ * where "other" counts the accesses to the watched pages outside any channel.
+ * Signals with storage outside rtSignal aren't listed. Returns the exit
+ * status.
+ */
+static int vsm_heat(vsm_model* m, int64_t ticks, const vsm_write* writes,
+		int32_t nwrites, const char* path, int json) {
+#ifndef VSM_HEAT
+	(void)m;
+	(void)ticks;
+	(void)writes;
+	(void)nwrites;
+	(void)path;
+	(void)json;
+	fprintf(stderr, "error: heat profiling requires x86-64 Linux\n");
+	return 1;
+#else
+	/* the signal table of a mirror build points at the mirror, so the step's
+	 * accesses to the mirrored signals in rtSignal wouldn't be counted */
+	if (dlsym(m->handle, "vsm_mirror") != NULL) {
+		fprintf(stderr, "error: %s was built with --signal-mirror (profile a "
+				"build without it)\n", m->path);
+		return 1;
+	}
+
+	if (vsm_init(m) != NI_OK) {
+		fprintf(stderr, "error: %s: model initialization failed\n", m->path);
+		return 1;
+	}
+
+	vsm_pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+
+	/* the extent of rtSignal comes from its symbol */
+	uintptr_t sigbegin = 0;
+	uintptr_t sigend = 0;
+	void* rtsignal = dlsym(m->handle, "rtSignal");
+	Dl_info dlinfo;
+	const ElfW(Sym)* sym = NULL;
+	if (rtsignal != NULL && dladdr1(rtsignal, &dlinfo, (void**)&sym,
+			RTLD_DL_SYMENT) != 0 && sym != NULL) {
+		sigbegin = (uintptr_t)rtsignal;
+		sigend = sigbegin + sym->st_size;
+	}
+
+	vsm_heat_spans(m, sigbegin, sigend);
+	vsm_heat_range(0, sigbegin, sigend);
+	vsm_heat_range(1, (uintptr_t)m->rtparams,
+			(uintptr_t)m->rtparams + (uintptr_t)m->paramstructsize);
+
+	int32_t channels = m->sigsize + m->paramsize;
+	vsm_reads = (uint64_t*)calloc((size_t)channels + 1, sizeof(uint64_t));
+	vsm_writes = (uint64_t*)calloc((size_t)channels + 1, sizeof(uint64_t));
+	if (vsm_reads == NULL || vsm_writes == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+
+	struct sigaction fault;
+	struct sigaction trap;
+	struct sigaction oldfault;
+	struct sigaction oldtrap;
+	memset(&fault, 0, sizeof(fault));
+	memset(&trap, 0, sizeof(trap));
+	fault.sa_sigaction = vsm_heat_fault;
+	fault.sa_flags = SA_SIGINFO;
+	trap.sa_sigaction = vsm_heat_trap;
+	trap.sa_flags = SA_SIGINFO;
+	sigaction(SIGSEGV, &fault, &oldfault);
+	sigaction(SIGTRAP, &trap, &oldtrap);
+
+	for (int64_t tick = 0; tick < ticks; ++tick) {
+		vsm_fill_inputs(m, tick);
+		for (int32_t w = 0; w < nwrites; ++w) {
+			if (writes[w].tick == tick) {
+				vsm_write_param(m, &writes[w]);
+			}
+		}
+		vsm_protect(PROT_NONE);
+		int32_t ret = m->step(m->in, m->out, (double)tick * m->baserate);
+		vsm_protect(PROT_READ | PROT_WRITE);
+		if (ret != NI_OK) {
+			fprintf(stderr, "error: %s: step failed at tick %lld\n", m->path,
+					(long long)tick);
+			return 1;
+		}
+	}
+
+	sigaction(SIGSEGV, &oldfault, NULL);
+	sigaction(SIGTRAP, &oldtrap, NULL);
+	m->finalize();
+
+	FILE* f = fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "error: failed to open %s\n", path);
+		return 1;
+	}
+
+	/* list the channels in the order of their storage */
+	uint64_t total = vsm_other;
+	int32_t untouched = 0;
+	fprintf(f, "{\"model\": \"%s\", \"ticks\": %lld, \"other\": %llu, "
+			"\"channels\": [", m->path, (long long)ticks,
+			(unsigned long long)vsm_other);
+	for (int32_t k = 0; k < vsm_nspans; ++k) {
+		int32_t i = vsm_spans[k].channel;
+		int issignal = i < m->sigsize;
+		const char* name = issignal ? m->signals[i].blockname :
+				m->params[i - m->sigsize].paramname;
+		const char* rel = strchr(name, '/');
+		fprintf(f, "%s\n  {\"kind\": \"%s\", \"path\": \"%s\", "
+				"\"reads\": %llu, \"writes\": %llu}", k > 0 ? "," : "",
+				issignal ? "signal" : "parameter", rel != NULL ? rel + 1 : name,
+				(unsigned long long)vsm_reads[i],
+				(unsigned long long)vsm_writes[i]);
+		total += vsm_reads[i] + vsm_writes[i];
+		untouched += vsm_reads[i] + vsm_writes[i] == 0;
+	}
+	fprintf(f, "\n]}\n");
+	if (fclose(f) != 0) {
+		fprintf(stderr, "error: failed to write %s\n", path);
+		return 1;
+	}
+
+	if (json) {
+		printf("{\"model\": \"%s\", \"ticks\": %lld, \"heat_file\": \"%s\", "
+				"\"channels\": %d, \"untouched\": %d, \"accesses\": %llu, "
+				"\"other\": %llu}\n", m->path, (long long)ticks, path,
+				vsm_nspans, untouched, (unsigned long long)total,
+				(unsigned long long)vsm_other);
+	} else {
+		printf("model:       %s\n", m->path);
+		printf("ticks:       %lld\n", (long long)ticks);
+		printf("heat file:   %s\n", path);
+		printf("channels:    %d (%d never accessed)\n", vsm_nspans, untouched);
+		printf("accesses:    %llu (%llu outside any channel)\n",
+				(unsigned long long)total, (unsigned long long)vsm_other);
+	}
+	return 0;
+#endif
+}
+
+int main(int argc, char** argv) {
+	int64_t ticks = 10000;
+	double budget_us = 0.0;
+	int json = 0;
+	int probe = 0;
+	int set = 0;
+	double tol = 0.0;
+	const char* path = NULL;
+	const char* other = NULL;
+	const char* tracepath = NULL;
+	const char* heatpath = NULL;
+	vsm_write writes[VSM_MAX_WRITES];
+	int32_t nwrites = 0;
+	const char* excludes[VSM_MAX_EXCLUDES];
+	int32_t nexcludes = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			ticks = atoll(argv[++i]);
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			budget_us = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-j") == 0) {
+			json = 1;
+		} else if (strcmp(argv[i], "-p") == 0) {
+			probe = 1;
+		} else if (strcmp(argv[i], "-s") == 0) {
+			set = 1;
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			tracepath = argv[++i];
+		} else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+			heatpath = argv[++i];
+		} else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+			other = argv[++i];
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			tol = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc &&
+				nexcludes < VSM_MAX_EXCLUDES) {
+			excludes[nexcludes++] = argv[++i];
+		} else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc &&
+				nwrites < VSM_MAX_WRITES &&
+				vsm_parse_write(argv[i + 1], &writes[nwrites])) {
+			++nwrites;
+			++i;
+		} else if (argv[i][0] != '-' && path == NULL) {
+			path = argv[i];
+		} else {
+			fprintf(stderr, "usage: %s [-n TICKS] [-b US] [-p] [-s] [-r FILE] [-a B.so] "
+					"[-w TICK:NAME=VALUE] [-t TOL] [-x NAME] [-H FILE] [-j] MODEL.so\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	if (path == NULL || ticks < 1) {
+		fprintf(stderr, "usage: %s [-n TICKS] [-b US] [-p] [-s] [-r FILE] [-a B.so] "
+				"[-w TICK:NAME=VALUE] [-t TOL] [-x NAME] [-H FILE] [-j] MODEL.so\n",
+				argv[0]);
+		return 1;
+	}
+
+	vsm_model model;
+	vsm_load(&model, path);
+
+	if (other != NULL) {
+		vsm_model modelb;
+		vsm_load(&modelb, other);
+		return vsm_lockstep(&model, &modelb, ticks, writes, nwrites, excludes,
+				nexcludes, tol, json);
+	}
+	if (heatpath != NULL) {
+		return vsm_heat(&model, ticks, writes, nwrites, heatpath, json);
+	}
+
+	int64_t t0 = vsm_now_ns();
+	if (vsm_init(&model) != NI_OK) {
+		fprintf(stderr, "error: %s: model initialization failed\n", path);
+		return 1;
+	}
+	int64_t init_ns = vsm_now_ns() - t0;
+
+	int64_t* times = (int64_t*)malloc((size_t)ticks * sizeof(int64_t));
+	if (times == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+
+	vsm_trace* trace = NULL;
+	if (tracepath != NULL) {
+		trace = vsm_trace_open(&model, tracepath);
+	}
+
+	int64_t total_ns = 0;
+	int64_t probe_ns = 0;
+	int64_t set_ns = 0;
+	int64_t elements = 0;
+	int64_t param_elements = 0;
+	volatile double sink = 0.0;
+	for (int32_t i = 0; i < model.sigsize; ++i) {
+		elements += model.signals[i].width;
+	}
+	for (int32_t i = 0; i < model.paramsize; ++i) {
+		param_elements += model.params[i].width;
+	}
+
+	for (int64_t tick = 0; tick < ticks; ++tick) {
+		vsm_fill_inputs(&model, tick);
+		for (int32_t w = 0; w < nwrites; ++w) {
+			if (writes[w].tick == tick) {
+				vsm_write_param(&model, &writes[w]);
+			}
+		}
+		int64_t start = vsm_now_ns();
+		int32_t ret = model.step(model.in, model.out,
+				(double)tick * model.baserate);
+		times[tick] = vsm_now_ns() - start;
+		total_ns += times[tick];
+		if (ret != NI_OK) {
+			fprintf(stderr, "error: %s: step failed at tick %lld\n", path,
+					(long long)tick);
+			return 1;
+		}
+		if (probe) {
+			start = vsm_now_ns();
+			sink += vsm_probe(&model);
+			probe_ns += vsm_now_ns() - start;
+		}
+		if (set) {
+			start = vsm_now_ns();
+			vsm_set(&model);
+			set_ns += vsm_now_ns() - start;
+		}
+		if (trace != NULL) {
+			vsm_trace_row(&model, trace, (double)tick * model.baserate);
+		}
+	}
+
+	if (trace != NULL && vsm_trace_close(trace) != 0) {
+		fprintf(stderr, "error: failed to write %s\n", tracepath);
+		return 1;
+	}
+
+	model.finalize();
+
+	qsort(times, (size_t)ticks, sizeof(int64_t), vsm_cmp_i64);
+	double mean_us = (double)total_ns / (double)ticks / 1e3;
+	double p50_us = (double)times[ticks / 2] / 1e3;
+	double p99_us = (double)times[(ticks * 99) / 100] / 1e3;
+	double max_us = (double)times[ticks - 1] / 1e3;
+	double probe_us = (double)probe_ns / (double)ticks / 1e3;
+	double probe_elem_ns = elements > 0 ?
+			(double)probe_ns / (double)ticks / (double)elements : 0.0;
+	double set_us = (double)set_ns / (double)ticks / 1e3;
+	double set_elem_ns = param_elements > 0 ?
+			(double)set_ns / (double)ticks / (double)param_elements : 0.0;
+
+	if (json) {
+		printf("{\"model\": \"%s\", \"ticks\": %lld, \"inports\": %d, "
+				"\"outports\": %d, \"signals\": %d, \"parameters\": %d, "
+				"\"init_us\": %.3f, \"step_mean_us\": %.3f, "
+				"\"step_p50_us\": %.3f, \"step_p99_us\": %.3f, "
+				"\"step_max_us\": %.3f",
+				path, (long long)ticks, model.inwidth, model.outwidth,
+				model.sigsize, model.paramsize, (double)init_ns / 1e3, mean_us,
+				p50_us, p99_us, max_us);
+		if (probe) {
+			printf(", \"probe_elements\": %lld, \"probe_mean_us\": %.3f, "
+					"\"probe_element_ns\": %.3f", (long long)elements,
+					probe_us, probe_elem_ns);
+		}
+		if (set) {
+			printf(", \"set_elements\": %lld, \"set_mean_us\": %.3f, "
+					"\"set_element_ns\": %.3f", (long long)param_elements,
+					set_us, set_elem_ns);
+		}
+		printf("}\n");
+	} else {
+		printf("model:       %s\n", path);
+		printf("ticks:       %lld\n", (long long)ticks);
+		printf("init:        %.3f us\n", (double)init_ns / 1e3);
+		printf("step mean:   %.3f us\n", mean_us);
+		printf("step p50:    %.3f us\n", p50_us);
+		printf("step p99:    %.3f us\n", p99_us);
+		printf("step max:    %.3f us\n", max_us);
+		if (probe) {
+			printf("probe:       %lld elements\n", (long long)elements);
+			printf("probe mean:  %.3f us (%.3f ns/element)\n", probe_us,
+					probe_elem_ns);
+		}
+		if (set) {
+			printf("set:         %lld elements\n", (long long)param_elements);
+			printf("set mean:    %.3f us (%.3f ns/element)\n", set_us,
+					set_elem_ns);
+		}
+	}
+
+	free(times);
+
+	if (budget_us > 0.0 && mean_us > budget_us) {
+		fprintf(stderr, "error: mean step time %.3f us exceeds budget of "
+				"%.3f us\n", mean_us, budget_us);
+		return 2;
+	}
+
+	return 0;
+}
 '''
 
-inportscast = 'const struct Inports* inports = (const struct Inports*)inData;\n'
-outportscast = 'struct Outports* outports = (struct Outports*)outData;\n'
-if len(inports) > 0:
-    output_model_src += '\t' + inportscast
+def FmtHostTrace() -> str:
+    """
+    Generate the trace converter, which transposes traces recorded by
+    vsmbench -r (one row per tick) into an Arrow IPC file (one column per
+    channel element) for dataframe tools. Like the benchmark driver, it's
+    independent of the model configuration: the channel layout is read from
+    the trace header, which vsmbench writes from the model's NIVS tables.
+
+    :returns: a string containing the trace converter source
+
+    """
+    header = f'''
+/*
+ * Auto-generated trace converter for VeriStand models.
+ *
+ * Generated {Timestamp()}
+ *
+ * You almost certainly do NOT want to edit this file, as it may be overwritten
+ * at any time!
+ */
+'''
+
+    return header + r'''
+/*
+ * Converts a trace recorded by vsmbench -r (one row of doubles per tick) to an
+ * Arrow IPC file with one float64 column per channel element, which dataframe
+ * tools (pyarrow, pandas, polars, ...) load directly. Vector channels are
+ * expanded to one column per element, named like "signals/x[3]" (1D) or
+ * "signals/m[1][2]" (2D).
+ *
+ * Each record batch is transposed from rows to columns by several threads,
+ * each handling a range of columns in cache-sized tiles, so both the rows read
+ * and the columns written stay in cache.
+ *
+ * vsmtrace can also find the ticks matching a query without converting the
+ * trace. Using the index written by vsmbench, only the blocks which may hold
+ * matching rows are mapped and scanned.
+ *
+ * Usage: vsmtrace [options] TRACE OUT.arrow
+ *        vsmtrace [options] -q CONDITION [-q ...] TRACE
+ *
+ *   -j THREADS    number of transposing threads (default: number of CPUs)
+ *   -m MB         approximate size of each record batch (default: 64)
+ *   -q CONDITION  print the ticks where CONDITION holds, like
+ *                 "signals/x[3] >= 2.5" (COLUMN OP VALUE, where OP is one of
+ *                 <, <=, >, >=, ==, or !=, and the column's "inports/",
+ *                 "outports/", or "signals/" may be left off if unambiguous);
+ *                 multiple conditions must all hold
+ *   -t T1 T2      only match ticks with times from T1 to T2
+ *   -c            print only the number of matching ticks
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Rows and columns in each transposition tile */
+#define VSM_TILE 32
+
+/* Arrow metadata constants */
+#define VSM_ARROW_V5 4
+#define VSM_ARROW_SCHEMA 1
+#define VSM_ARROW_RECORDBATCH 3
+#define VSM_ARROW_FLOATINGPOINT 3
+#define VSM_ARROW_DOUBLE 2
+
+static void* vsm_alloc(size_t size) {
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+/*
+ * Minimal FlatBuffers builder for the Arrow metadata. Like the reference
+ * builders, it builds back to front: the buffer grows downwards from its end
+ * and objects are referred to by their distance from the end, so the children
+ * of a table (built first) end up after the offsets pointing to them.
+ */
+typedef struct vsm_fb {
+	uint8_t* buf;
+	size_t cap;
+	size_t used;
+	size_t table;       /* value of used when the current table was started */
+	uint32_t fields[8]; /* positions of the current table's fields */
+	int nfields;
+} vsm_fb;
+
+static void vsm_fb_reserve(vsm_fb* b, size_t n) {
+	if (b->cap - b->used >= n) {
+		return;
+	}
+	size_t cap = b->cap > 0 ? b->cap : 1024;
+	while (cap - b->used < n) {
+		cap *= 2;
+	}
+	uint8_t* buf = (uint8_t*)vsm_alloc(cap);
+	if (b->used > 0) {
+		memcpy(buf + cap - b->used, b->buf + b->cap - b->used, b->used);
+	}
+	free(b->buf);
+	b->buf = buf;
+	b->cap = cap;
+}
+
+/* Prepend bytes */
+static void vsm_fb_put(vsm_fb* b, const void* p, size_t n) {
+	if (n == 0) {
+		return;
+	}
+	vsm_fb_reserve(b, n);
+	b->used += n;
+	memcpy(b->buf + b->cap - b->used, p, n);
+}
+
+/* Pad so that n bytes prepended next start at a multiple of align */
+static void vsm_fb_align(vsm_fb* b, size_t n, size_t align) {
+	static const uint8_t zeros[8] = {0};
+	vsm_fb_put(b, zeros, (align - (b->used + n) % align) % align);
+}
+
+static uint32_t vsm_fb_string(vsm_fb* b, const char* s) {
+	uint32_t len = (uint32_t)strlen(s);
+	vsm_fb_align(b, len + 1, 4);
+	vsm_fb_put(b, "", 1);
+	vsm_fb_put(b, s, len);
+	vsm_fb_put(b, &len, 4);
+	return (uint32_t)b->used;
+}
+
+/* Vector of n scalars or structs of size bytes each */
+static uint32_t vsm_fb_vector(vsm_fb* b, const void* data, uint32_t n,
+		size_t size, size_t align) {
+	vsm_fb_align(b, (size_t)n * size, align < 4 ? 4 : align);
+	vsm_fb_put(b, data, (size_t)n * size);
+	vsm_fb_put(b, &n, 4);
+	return (uint32_t)b->used;
+}
+
+/* Vector of n tables or strings */
+static uint32_t vsm_fb_offsets(vsm_fb* b, const uint32_t* refs, uint32_t n) {
+	vsm_fb_align(b, (size_t)n * 4, 4);
+	for (uint32_t i = n; i-- > 0;) {
+		uint32_t off = (uint32_t)(b->used + 4) - refs[i];
+		vsm_fb_put(b, &off, 4);
+	}
+	vsm_fb_put(b, &n, 4);
+	return (uint32_t)b->used;
+}
+
+static void vsm_fb_start(vsm_fb* b, int nfields) {
+	b->table = b->used;
+	b->nfields = nfields;
+	memset(b->fields, 0, sizeof(b->fields));
+}
+
+static void vsm_fb_scalar(vsm_fb* b, int field, const void* p, size_t n) {
+	vsm_fb_align(b, n, n);
+	vsm_fb_put(b, p, n);
+	b->fields[field] = (uint32_t)b->used;
+}
+
+static void vsm_fb_offset(vsm_fb* b, int field, uint32_t ref) {
+	vsm_fb_align(b, 4, 4);
+	uint32_t off = (uint32_t)(b->used + 4) - ref;
+	vsm_fb_put(b, &off, 4);
+	b->fields[field] = (uint32_t)b->used;
+}
+
+/* Finish the current table with its vtable (placed right before it) */
+static uint32_t vsm_fb_end(vsm_fb* b) {
+	uint16_t vtable[2 + 8];
+	int32_t soff = 0;
+
+	vsm_fb_align(b, 4, 4);
+	vsm_fb_put(b, &soff, 4);
+	uint32_t table = (uint32_t)b->used;
+
+	vtable[0] = (uint16_t)(4 + 2 * b->nfields);
+	vtable[1] = (uint16_t)(table - b->table);
+	for (int i = 0; i < b->nfields; ++i) {
+		vtable[2 + i] = b->fields[i] != 0 ?
+				(uint16_t)(table - b->fields[i]) : 0;
+	}
+	vsm_fb_put(b, vtable, vtable[0]);
+
+	soff = (int32_t)(b->used - table);
+	memcpy(b->buf + b->cap - table, &soff, 4);
+	return table;
+}
+
+/* Add the root offset; the finished buffer is a multiple of 8 bytes */
+static void vsm_fb_finish(vsm_fb* b, uint32_t root) {
+	vsm_fb_align(b, 4, 8);
+	uint32_t off = (uint32_t)(b->used + 4) - root;
+	vsm_fb_put(b, &off, 4);
+}
+
+static const uint8_t* vsm_fb_data(const vsm_fb* b) {
+	return b->buf + b->cap - b->used;
+}
+
+/* Arrow Schema table: one non-nullable float64 field per column */
+static uint32_t vsm_arrow_schema(vsm_fb* b, char** names, uint32_t n) {
+	int16_t precision = VSM_ARROW_DOUBLE;
+	uint8_t typetype = VSM_ARROW_FLOATINGPOINT;
+	uint32_t* fields = (uint32_t*)vsm_alloc((size_t)n * sizeof(uint32_t));
+
+	/* every field shares its type and (empty) list of children */
+	vsm_fb_start(b, 1);
+	vsm_fb_scalar(b, 0, &precision, sizeof(precision));
+	uint32_t type = vsm_fb_end(b);
+	uint32_t children = vsm_fb_offsets(b, NULL, 0);
+
+	for (uint32_t i = 0; i < n; ++i) {
+		uint32_t name = vsm_fb_string(b, names[i]);
+		vsm_fb_start(b, 7);
+		vsm_fb_offset(b, 0, name);
+		vsm_fb_offset(b, 3, type);
+		vsm_fb_offset(b, 5, children);
+		vsm_fb_scalar(b, 2, &typetype, sizeof(typetype));
+		fields[i] = vsm_fb_end(b);
+	}
+
+	uint32_t list = vsm_fb_offsets(b, fields, n);
+	free(fields);
+	vsm_fb_start(b, 4);
+	vsm_fb_offset(b, 1, list);
+	return vsm_fb_end(b);
+}
+
+/* Arrow Message table */
+static uint32_t vsm_arrow_message(vsm_fb* b, uint8_t type, uint32_t header,
+		int64_t bodylen) {
+	int16_t version = VSM_ARROW_V5;
+	vsm_fb_start(b, 5);
+	vsm_fb_scalar(b, 3, &bodylen, sizeof(bodylen));
+	vsm_fb_offset(b, 2, header);
+	vsm_fb_scalar(b, 0, &version, sizeof(version));
+	vsm_fb_scalar(b, 1, &type, sizeof(type));
+	return vsm_fb_end(b);
+}
+
+/* Write an encapsulated message's metadata; returns the bytes written */
+static int32_t vsm_arrow_write_meta(FILE* f, const vsm_fb* b) {
+	uint32_t marker = 0xFFFFFFFFu;
+	int32_t len = (int32_t)b->used;
+	fwrite(&marker, sizeof(marker), 1, f);
+	fwrite(&len, sizeof(len), 1, f);
+	fwrite(vsm_fb_data(b), 1, b->used, f);
+	return 8 + len;
+}
+
+/* Arrow FieldNode and Buffer structs */
+typedef struct vsm_arrow_pair {
+	int64_t a;
+	int64_t b;
+} vsm_arrow_pair;
+
+/* Arrow Block struct (a record batch's location in the file) */
+typedef struct vsm_arrow_block {
+	int64_t offset;
+	int32_t metalen;
+	int32_t pad;
+	int64_t bodylen;
+} vsm_arrow_block;
+
+/* Columns transposed by one thread */
+typedef struct vsm_job {
+	const double* in;
+	double* out;
+	int64_t rows;
+	int64_t width;
+	int64_t col0;
+	int64_t col1;
+} vsm_job;
+
+static void* vsm_transpose(void* arg) {
+	const vsm_job* j = (const vsm_job*)arg;
+	for (int64_t c0 = j->col0; c0 < j->col1; c0 += VSM_TILE) {
+		int64_t c1 = c0 + VSM_TILE < j->col1 ? c0 + VSM_TILE : j->col1;
+		for (int64_t r0 = 0; r0 < j->rows; r0 += VSM_TILE) {
+			int64_t r1 = r0 + VSM_TILE < j->rows ? r0 + VSM_TILE : j->rows;
+			for (int64_t c = c0; c < c1; ++c) {
+				const double* src = j->in + r0 * j->width + c;
+				double* dst = j->out + c * j->rows + r0;
+				for (int64_t r = r0; r < r1; ++r) {
+					*dst++ = *src;
+					src += j->width;
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Transpose rows x width doubles into columns using several threads */
+static void vsm_transpose_batch(const double* in, double* out, int64_t rows,
+		int64_t width, int threads) {
+	vsm_job jobs[64];
+	pthread_t ids[64];
+	int started[64] = {0};
+	int64_t chunk = (width + threads - 1) / threads;
+	chunk = (chunk + VSM_TILE - 1) / VSM_TILE * VSM_TILE;
+
+	for (int t = 0; t < threads; ++t) {
+		jobs[t].in = in;
+		jobs[t].out = out;
+		jobs[t].rows = rows;
+		jobs[t].width = width;
+		jobs[t].col0 = (int64_t)t * chunk < width ? (int64_t)t * chunk : width;
+		jobs[t].col1 = jobs[t].col0 + chunk < width ?
+				jobs[t].col0 + chunk : width;
+	}
+	for (int t = 1; t < threads; ++t) {
+		started[t] = pthread_create(&ids[t], NULL, vsm_transpose,
+				&jobs[t]) == 0;
+		if (!started[t]) {
+			vsm_transpose(&jobs[t]);
+		}
+	}
+	vsm_transpose(&jobs[0]);
+	for (int t = 1; t < threads; ++t) {
+		if (started[t]) {
+			pthread_join(ids[t], NULL);
+		}
+	}
+}
+
+/* A trace opened by vsm_trace_load() (see vsm_trace_open() in vsmbench.c) */
+typedef struct vsm_tracefile {
+	const char* path;
+	int fd;
+	uint64_t size;
+	uint64_t width;      /* doubles per row */
+	int64_t blockrows;   /* rows per block */
+	char** names;        /* column names */
+	uint64_t data;       /* file offset of the first row */
+	int64_t rows;
+	int64_t blocks;
+	const double* index; /* block summaries (NULL if there's no index) */
+	void* indexmap;
+	size_t indexmaplen;
+} vsm_tracefile;
+
+/* A region of a file mapped by vsm_map() */
+typedef struct vsm_region {
+	void* base;
+	size_t len;
+	const uint8_t* p; /* the requested offset */
+} vsm_region;
+
+static int vsm_map(int fd, uint64_t offset, uint64_t len, vsm_region* r) {
+	uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+	uint64_t start = offset / page * page;
+	r->len = (size_t)(offset - start + len);
+	r->base = mmap(NULL, r->len > 0 ? r->len : 1, PROT_READ, MAP_PRIVATE, fd,
+			(off_t)start);
+	if (r->base == MAP_FAILED) {
+		return 0;
+	}
+	r->p = (const uint8_t*)r->base + (offset - start);
+	return 1;
+}
+
+static void vsm_unmap(vsm_region* r) {
+	munmap(r->base, r->len > 0 ? r->len : 1);
+}
+
+/* Read a trace's header and index and name its columns */
+static void vsm_trace_load(vsm_tracefile* tf, const char* path) {
+	memset(tf, 0, sizeof(*tf));
+	tf->path = path;
+
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "error: can't open %s\n", path);
+		exit(1);
+	}
+
+	char magic[8];
+	uint32_t head[2];
+	uint32_t block[2];
+	if (fread(magic, 1, 8, f) != 8 || memcmp(magic, "VSMTRACE", 8) != 0 ||
+			fread(head, sizeof(uint32_t), 2, f) != 2 || head[0] != 2 ||
+			fread(&tf->width, sizeof(uint64_t), 1, f) != 1 ||
+			fread(block, sizeof(uint32_t), 2, f) != 2 || tf->width == 0 ||
+			block[0] == 0) {
+		fprintf(stderr, "error: %s is not a vsmbench trace\n", path);
+		exit(1);
+	}
+	tf->blockrows = block[0];
+
+	/* expand the channels to one named column per element */
+	tf->names = (char**)vsm_alloc((size_t)tf->width * sizeof(char*));
+	uint64_t ncols = 0;
+	uint64_t pos = 32;
+	for (uint32_t c = 0; c < head[1]; ++c) {
+		uint32_t dims[3];
+		char name[1024];
+		if (fread(dims, sizeof(uint32_t), 3, f) != 3 || dims[2] >= sizeof(name) ||
+				fread(name, 1, dims[2], f) != dims[2]) {
+			break;
+		}
+		name[dims[2]] = '\0';
+		pos += 12 + dims[2];
+
+		for (uint32_t x = 0; x < dims[0] && ncols <= tf->width; ++x) {
+			for (uint32_t y = 0; y < dims[1] && ncols <= tf->width; ++y) {
+				char col[1100];
+				if (dims[1] > 1) {
+					snprintf(col, sizeof(col), "%s[%u][%u]", name, x, y);
+				} else if (dims[0] > 1) {
+					snprintf(col, sizeof(col), "%s[%u]", name, x);
+				} else {
+					snprintf(col, sizeof(col), "%s", name);
+				}
+				if (ncols < tf->width) {
+					tf->names[ncols] = strdup(col);
+				}
+				++ncols;
+			}
+		}
+	}
+	fclose(f);
+	if (ncols != tf->width) {
+		fprintf(stderr, "error: %s: bad channel layout\n", path);
+		exit(1);
+	}
+	tf->data = (pos + 7) / 8 * 8;
+
+	tf->fd = open(path, O_RDONLY);
+	struct stat st;
+	if (tf->fd < 0 || fstat(tf->fd, &st) != 0) {
+		fprintf(stderr, "error: can't open %s\n", path);
+		exit(1);
+	}
+	tf->size = (uint64_t)st.st_size;
+	uint64_t rowbytes = tf->width * sizeof(double);
+
+	/* the index, if the recording finished */
+	uint64_t tail[3];
+	if (tf->size >= tf->data + sizeof(tail) &&
+			pread(tf->fd, tail, sizeof(tail), (off_t)(tf->size - sizeof(tail)))
+			== (ssize_t)sizeof(tail) && memcmp(&tail[2], "VSMINDEX", 8) == 0 &&
+			tail[1] >= tf->data && (tail[1] - tf->data) % rowbytes == 0 &&
+			tail[1] + tail[0] * rowbytes * 4 + sizeof(tail) == tf->size) {
+		vsm_region r;
+		tf->rows = (int64_t)((tail[1] - tf->data) / rowbytes);
+		tf->blocks = (int64_t)tail[0];
+		if (tf->blocks > 0 && vsm_map(tf->fd, tail[1], tail[0] * rowbytes * 4,
+				&r)) {
+			tf->index = (const double*)r.p;
+			tf->indexmap = r.base;
+			tf->indexmaplen = r.len;
+		}
+	} else {
+		uint64_t left = tf->size > tf->data ? tf->size - tf->data : 0;
+		tf->rows = (int64_t)(left / rowbytes);
+		tf->blocks = (tf->rows + tf->blockrows - 1) / tf->blockrows;
+		fprintf(stderr, "warning: %s has no index (recording cut short?)\n",
+				path);
+		if (left % rowbytes != 0) {
+			fprintf(stderr, "warning: %s: ignoring a partial row\n", path);
+		}
+	}
+}
+
+/* Convert a trace to an Arrow IPC file; returns the exit status */
+static int vsm_convert(vsm_tracefile* tf, const char* outpath, int threads,
+		double batchmb) {
+	int64_t width = (int64_t)tf->width;
+	int64_t rowbytes = width * (int64_t)sizeof(double);
+	int64_t batchrows = (int64_t)(batchmb * 1048576.0) / rowbytes;
+	batchrows = batchrows < 1 ? 1 : batchrows;
+	int64_t nbatches = (tf->rows + batchrows - 1) / batchrows;
+
+	vsm_region rows;
+	if (!vsm_map(tf->fd, tf->data, (uint64_t)(tf->rows * rowbytes), &rows)) {
+		fprintf(stderr, "error: can't map %s\n", tf->path);
+		return 1;
+	}
+	const double* data = (const double*)rows.p;
+
+	FILE* f = fopen(outpath, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "error: can't open %s\n", outpath);
+		return 1;
+	}
+
+	/* file magic (padded to 8 bytes) and the schema message */
+	int64_t offset = 8;
+	fwrite("ARROW1\0\0", 1, 8, f);
+
+	vsm_fb b;
+	memset(&b, 0, sizeof(b));
+	uint32_t schema = vsm_arrow_schema(&b, tf->names, (uint32_t)width);
+	vsm_fb_finish(&b, vsm_arrow_message(&b, VSM_ARROW_SCHEMA, schema, 0));
+	offset += vsm_arrow_write_meta(f, &b);
+
+	/* record batches */
+	vsm_arrow_block* blocks = (vsm_arrow_block*)vsm_alloc(
+			(size_t)nbatches * sizeof(vsm_arrow_block));
+	vsm_arrow_pair* nodes = (vsm_arrow_pair*)vsm_alloc(
+			(size_t)width * sizeof(vsm_arrow_pair));
+	vsm_arrow_pair* buffers = (vsm_arrow_pair*)vsm_alloc(
+			(size_t)width * 2 * sizeof(vsm_arrow_pair));
+	double* columns = (double*)vsm_alloc((size_t)batchrows * (size_t)rowbytes);
+
+	for (int64_t k = 0; k < nbatches; ++k) {
+		int64_t first = k * batchrows;
+		int64_t n = tf->rows - first < batchrows ? tf->rows - first : batchrows;
+		int64_t bodylen = n * rowbytes;
+
+		vsm_transpose_batch(data + first * width, columns, n, width, threads);
+
+		/* no validity bitmaps, so each column's validity buffer is empty */
+		for (int64_t c = 0; c < width; ++c) {
+			nodes[c].a = n;
+			nodes[c].b = 0;
+			buffers[2 * c].a = c * n * (int64_t)sizeof(double);
+			buffers[2 * c].b = 0;
+			buffers[2 * c + 1].a = buffers[2 * c].a;
+			buffers[2 * c + 1].b = n * (int64_t)sizeof(double);
+		}
+
+		b.used = 0;
+		uint32_t bufvec = vsm_fb_vector(&b, buffers, (uint32_t)width * 2,
+				sizeof(vsm_arrow_pair), 8);
+		uint32_t nodevec = vsm_fb_vector(&b, nodes, (uint32_t)width,
+				sizeof(vsm_arrow_pair), 8);
+		vsm_fb_start(&b, 5);
+		vsm_fb_scalar(&b, 0, &n, sizeof(n));
+		vsm_fb_offset(&b, 1, nodevec);
+		vsm_fb_offset(&b, 2, bufvec);
+		uint32_t batch = vsm_fb_end(&b);
+		vsm_fb_finish(&b, vsm_arrow_message(&b, VSM_ARROW_RECORDBATCH, batch,
+				bodylen));
+
+		blocks[k].offset = offset;
+		blocks[k].metalen = vsm_arrow_write_meta(f, &b);
+		blocks[k].pad = 0;
+		blocks[k].bodylen = bodylen;
+		fwrite(columns, 1, (size_t)bodylen, f);
+		offset += blocks[k].metalen + bodylen;
+	}
+	vsm_unmap(&rows);
+
+	/* end of stream marker, footer, and trailing magic */
+	uint32_t eos[2] = {0xFFFFFFFFu, 0};
+	fwrite(eos, sizeof(eos), 1, f);
+
+	b.used = 0;
+	int16_t version = VSM_ARROW_V5;
+	schema = vsm_arrow_schema(&b, tf->names, (uint32_t)width);
+	uint32_t dicts = vsm_fb_vector(&b, NULL, 0, sizeof(vsm_arrow_block), 8);
+	uint32_t batches = vsm_fb_vector(&b, blocks, (uint32_t)nbatches,
+			sizeof(vsm_arrow_block), 8);
+	vsm_fb_start(&b, 5);
+	vsm_fb_offset(&b, 1, schema);
+	vsm_fb_offset(&b, 2, dicts);
+	vsm_fb_offset(&b, 3, batches);
+	vsm_fb_scalar(&b, 0, &version, sizeof(version));
+	vsm_fb_finish(&b, vsm_fb_end(&b));
+
+	int32_t footerlen = (int32_t)b.used;
+	fwrite(vsm_fb_data(&b), 1, b.used, f);
+	fwrite(&footerlen, sizeof(footerlen), 1, f);
+	fwrite("ARROW1", 1, 6, f);
+
+	if (fclose(f) != 0) {
+		fprintf(stderr, "error: failed to write %s\n", outpath);
+		return 1;
+	}
+
+	printf("%s: %lld rows, %lld columns, %lld batches\n", outpath,
+			(long long)tf->rows, (long long)width, (long long)nbatches);
+	return 0;
+}
+
+/* A query condition: COLUMN OP VALUE */
+typedef struct vsm_cond {
+	int64_t col;
+	int op;
+	double value;
+} vsm_cond;
+
+enum { VSM_LT, VSM_LE, VSM_GT, VSM_GE, VSM_EQ, VSM_NE };
+
+#define VSM_MAX_CONDS 64
+
+/* Find a column by its name, with or without its kind (e.g. "inports/") */
+static int64_t vsm_find_column(vsm_tracefile* tf, const char* name) {
+	int64_t found = -1;
+	for (int64_t c = 0; c < (int64_t)tf->width; ++c) {
+		const char* rel = strchr(tf->names[c], '/');
+		if (strcmp(tf->names[c], name) == 0) {
+			return c;
+		}
+		if (rel != NULL && strcmp(rel + 1, name) == 0) {
+			if (found >= 0) {
+				fprintf(stderr, "error: column %s is ambiguous\n", name);
+				exit(1);
+			}
+			found = c;
+		}
+	}
+	if (found < 0) {
+		fprintf(stderr, "error: no column %s\n", name);
+		exit(1);
+	}
+	return found;
+}
+
+/* Parse a condition like "scalar_in > 5" */
+static void vsm_parse_cond(vsm_tracefile* tf, const char* arg, vsm_cond* q) {
+	static const struct {
+		const char* s;
+		int op;
+	} ops[] = {{"<=", VSM_LE}, {">=", VSM_GE}, {"==", VSM_EQ}, {"!=", VSM_NE},
+			{"<", VSM_LT}, {">", VSM_GT}, {"=", VSM_EQ}};
+	const char* at = strpbrk(arg, "<>=!");
+	char name[1100];
+	char* end;
+
+	for (size_t k = 0; at != NULL && k < sizeof(ops) / sizeof(ops[0]); ++k) {
+		size_t len = strlen(ops[k].s);
+		if (strncmp(at, ops[k].s, len) != 0) {
+			continue;
+		}
+		size_t n = (size_t)(at - arg);
+		while (n > 0 && arg[n - 1] == ' ') {
+			--n;
+		}
+		while (n > 0 && *arg == ' ') {
+			++arg;
+			--n;
+		}
+		if (n == 0 || n >= sizeof(name)) {
+			break;
+		}
+		memcpy(name, arg, n);
+		name[n] = '\0';
+		q->value = strtod(at + len, &end);
+		if (end == at + len) {
+			break;
+		}
+		q->col = vsm_find_column(tf, name);
+		q->op = ops[k].op;
+		return;
+	}
+
+	fprintf(stderr, "error: bad condition '%s' (expected COLUMN OP VALUE)\n",
+			arg);
+	exit(1);
+}
+
+/* Test a value (NaN never passes) */
+static int vsm_test(int op, double x, double v) {
+	switch (op) {
+		case VSM_LT: return x < v;
+		case VSM_LE: return x <= v;
+		case VSM_GT: return x > v;
+		case VSM_GE: return x >= v;
+		case VSM_EQ: return x == v;
+		default: return x < v || x > v;
+	}
+}
+
+/* Whether a block with values from lo to hi may have a value passing a test */
+static int vsm_may_pass(int op, double lo, double hi, double v) {
+	switch (op) {
+		case VSM_LT: return lo < v;
+		case VSM_LE: return lo <= v;
+		case VSM_GT: return hi > v;
+		case VSM_GE: return hi >= v;
+		case VSM_EQ: return lo <= v && v <= hi;
+		default: return lo < v || hi > v;
+	}
+}
+
+/*
+ * Print the ticks passing all of the conditions. Blocks which can't pass (by
+ * the index) are skipped without being read, and each other block is mapped
+ * only while it's scanned. Returns the exit status.
+ */
+static int vsm_query(vsm_tracefile* tf, const vsm_cond* conds, int nconds,
+		int countonly) {
+	int64_t width = (int64_t)tf->width;
+	int64_t rowbytes = width * (int64_t)sizeof(double);
+	int64_t matches = 0;
+	int64_t scanned = 0;
+
+	/* print each tested column once (besides the time) */
+	int64_t shown[VSM_MAX_CONDS];
+	int nshown = 0;
+	for (int q = 0; q < nconds; ++q) {
+		int dup = conds[q].col == 0;
+		for (int k = 0; k < nshown && !dup; ++k) {
+			dup = shown[k] == conds[q].col;
+		}
+		if (!dup) {
+			shown[nshown++] = conds[q].col;
+		}
+	}
+
+	if (!countonly) {
+		printf("tick\ttime");
+		for (int k = 0; k < nshown; ++k) {
+			printf("\t%s", tf->names[shown[k]]);
+		}
+		printf("\n");
+	}
+
+	for (int64_t k = 0; k < tf->blocks; ++k) {
+		int may = 1;
+		for (int q = 0; q < nconds && may && tf->index != NULL; ++q) {
+			const double* s = tf->index + (k * width + conds[q].col) * 4;
+			may = vsm_may_pass(conds[q].op, s[0], s[1], conds[q].value);
+		}
+		if (!may) {
+			continue;
+		}
+
+		int64_t first = k * tf->blockrows;
+		int64_t n = tf->rows - first < tf->blockrows ?
+				tf->rows - first : tf->blockrows;
+		vsm_region r;
+		if (!vsm_map(tf->fd, tf->data + (uint64_t)(first * rowbytes),
+				(uint64_t)(n * rowbytes), &r)) {
+			fprintf(stderr, "error: can't map %s\n", tf->path);
+			return 1;
+		}
+		++scanned;
+
+		const double* row = (const double*)r.p;
+		for (int64_t i = 0; i < n; ++i, row += width) {
+			int pass = 1;
+			for (int q = 0; q < nconds && pass; ++q) {
+				pass = vsm_test(conds[q].op, row[conds[q].col], conds[q].value);
+			}
+			if (!pass) {
+				continue;
+			}
+			++matches;
+			if (!countonly) {
+				printf("%lld\t%.17g", (long long)(first + i), row[0]);
+				for (int k = 0; k < nshown; ++k) {
+					printf("\t%.17g", row[shown[k]]);
+				}
+				printf("\n");
+			}
+		}
+		vsm_unmap(&r);
+	}
+
+	if (countonly) {
+		printf("%lld\n", (long long)matches);
+	}
+	fprintf(stderr, "%lld matching ticks, %lld of %lld blocks scanned\n",
+			(long long)matches, (long long)scanned, (long long)tf->blocks);
+	return 0;
+}
+
+static void vsm_usage(const char* argv0) {
+	fprintf(stderr, "usage: %s [-j THREADS] [-m MB] TRACE OUT.arrow\n"
+			"       %s [-t T1 T2] [-c] -q CONDITION [-q ...] TRACE\n", argv0,
+			argv0);
+	exit(1);
+}
+
+int main(int argc, char** argv) {
+	int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	double batchmb = 64.0;
+	const char* inpath = NULL;
+	const char* outpath = NULL;
+	const char* queries[VSM_MAX_CONDS];
+	int nqueries = 0;
+	int countonly = 0;
+	int timerange = 0;
+	double t1 = 0.0;
+	double t2 = 0.0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			batchmb = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc &&
+				nqueries < VSM_MAX_CONDS - 2) {
+			queries[nqueries++] = argv[++i];
+		} else if (strcmp(argv[i], "-t") == 0 && i + 2 < argc) {
+			timerange = 1;
+			t1 = atof(argv[++i]);
+			t2 = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-c") == 0) {
+			countonly = 1;
+		} else if (argv[i][0] != '-' && inpath == NULL) {
+			inpath = argv[i];
+		} else if (argv[i][0] != '-' && outpath == NULL) {
+			outpath = argv[i];
+		} else {
+			vsm_usage(argv[0]);
+		}
+	}
+	if (inpath == NULL || batchmb <= 0.0 ||
+			(nqueries == 0 && (outpath == NULL || timerange || countonly)) ||
+			(nqueries > 0 && outpath != NULL)) {
+		vsm_usage(argv[0]);
+	}
+	threads = threads < 1 ? 1 : threads > 64 ? 64 : threads;
+
+	vsm_tracefile tf;
+	vsm_trace_load(&tf, inpath);
+
+	if (nqueries == 0) {
+		return vsm_convert(&tf, outpath, threads, batchmb);
+	}
+
+	/* the time range is just two more conditions on the time column */
+	vsm_cond conds[VSM_MAX_CONDS];
+	int nconds = 0;
+	for (int q = 0; q < nqueries; ++q) {
+		vsm_parse_cond(&tf, queries[q], &conds[nconds++]);
+	}
+	if (timerange) {
+		conds[nconds].col = 0;
+		conds[nconds].op = VSM_GE;
+		conds[nconds++].value = t1;
+		conds[nconds].col = 0;
+		conds[nconds].op = VSM_LE;
+		conds[nconds++].value = t2;
+	}
+	return vsm_query(&tf, conds, nconds, countonly);
+}
+'''
+
+
+# feature test macro for the POSIX/GNU extensions (threads, clocks, CPU
+# affinity) used by optional features under strict -std= modes
+GNU_SOURCE = '#ifndef _GNU_SOURCE\n#define _GNU_SOURCE\n#endif\n'
+
+# includes shared by several optional features, spelled the same everywhere so
+# the include lists drop the duplicates
+STRING_H = '#include <string.h> /* memcpy(), memset() */\n'
+MATH_H = '#include <math.h>\n'
+
+def FmtHooks(hooks: list) -> str:
+    """
+    Format code contributed by optional features to one of the USER_
+    functions.
+
+    :param hooks: list of code blocks (each indented and ending with a newline)
+
+    :returns: the code, beginning with a newline (empty if there are no hooks)
+
+    """
+    if len(hooks) == 0:
+        return ''
+    return '\n' + '\n'.join(hooks)
+
+def FmtPrelude(prelude: list) -> str:
+    """
+    Format the feature test macros required by optional features. These must
+    come before any includes.
+
+    :param prelude: list of macro definitions (duplicates are removed)
+
+    :returns: the definitions, beginning with a newline (empty if there are
+    none)
+
+    """
+    if len(prelude) == 0:
+        return ''
+    return '\n' + ''.join(dict.fromkeys(prelude))
+
+def FmtLog():
+    """
+    Generate the deferred-formatting binary logger. VSM_LOG() only stores the
+    address of a static descriptor for its call site (format string and
+    argument types), the step timestamp, and the raw argument values into
+    a single-producer/single-consumer ring. A background thread started by
+    USER_Initialize() writes the records to a binary log file, along with each
+    descriptor the first time it's seen, so vsmlog_decode.py can format them
+    offline.
+
+    The generated code is added to the header, source, and USER_ function hook
+    lists.
+
+    """
+    words = args.log_ring
+    if words < 64 or words & (words - 1) != 0:
+        Die("--log-ring must be a power of two of at least 64")
+
+    logfile = args.log_file
+    if len(logfile) == 0:
+        logfile = f'/tmp/{config["name"]}.vsmlog'
+
+    headerincludes.append(STRING_H)
+
+    headerdefs.append(f'''
+/*
+ * Deferred-formatting binary logging.
+ *
+ * VSM_LOG(fmt, ...) records a printf-style message with up to 8 integer or
+ * floating point arguments (no strings or pointers). Only the call site's ID,
+ * the step timestamp, and the raw argument values are copied into a lock-free
+ * ring; formatting happens offline with vsmlog_decode.py. VSM_LOG must only be
+ * called from the step thread (including the model's Initialize, Start, and
+ * Step functions). Messages are dropped (and counted) if the ring is full.
+ */
+#define VSM_LOG_RING_WORDS {words}
+#define VSM_LOG_MAX_ARGS 8
+
+/* Static descriptor of a VSM_LOG call site */
+typedef struct vsm_logfmt {{
+\tconst char* fmt;
+\tuint32_t nargs;
+\tchar types[VSM_LOG_MAX_ARGS]; /* 'i' signed, 'u' unsigned, 'd' double */
+}} vsm_logfmt;
+
+/* Log ring (producer and consumer fields are on separate cache lines) */
+typedef struct vsm_logring {{
+\tuint64_t head;
+\tuint64_t tail_cache;
+\tuint64_t dropped;
+\tdouble time;
+\tchar pad0_[32];
+\tuint64_t tail;
+\tchar pad1_[56];
+\tuint64_t ring[VSM_LOG_RING_WORDS];
+}} vsm_logring;
+
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+extern vsm_logring vsm_log;
+
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+
+static inline void vsm_log_write(const vsm_logfmt* desc, const uint64_t* args) {{
+\tuint64_t head = vsm_log.head;
+\tuint64_t n = 2 + desc->nargs;
+\tuint32_t i;
+
+\tif (head + n - vsm_log.tail_cache > VSM_LOG_RING_WORDS) {{
+\t\tvsm_log.tail_cache = __atomic_load_n(&vsm_log.tail, __ATOMIC_ACQUIRE);
+\t\tif (head + n - vsm_log.tail_cache > VSM_LOG_RING_WORDS) {{
+\t\t\t/* read by the flush thread (only this thread writes it) */
+\t\t\t__atomic_store_n(&vsm_log.dropped,
+\t\t\t\t\t__atomic_load_n(&vsm_log.dropped, __ATOMIC_RELAXED) + 1,
+\t\t\t\t\t__ATOMIC_RELAXED);
+\t\t\treturn;
+\t\t}}
+\t}}
+
+\tvsm_log.ring[head & (VSM_LOG_RING_WORDS - 1)] = (uint64_t)(uintptr_t)desc;
+\tmemcpy(&vsm_log.ring[(head + 1) & (VSM_LOG_RING_WORDS - 1)], &vsm_log.time,
+\t\t\tsizeof(double));
+\tfor (i = 0; i < desc->nargs; ++i) {{
+\t\tvsm_log.ring[(head + 2 + i) & (VSM_LOG_RING_WORDS - 1)] = args[i];
+\t}}
+\t__atomic_store_n(&vsm_log.head, head + n, __ATOMIC_RELEASE);
+}}
+
+static inline uint64_t vsm_log_dbl(double x) {{
+\tuint64_t u;
+\tmemcpy(&u, &x, sizeof(u));
+\treturn u;
+}}
+static inline uint64_t vsm_log_int(int64_t x) {{ return (uint64_t)x; }}
+static inline uint64_t vsm_log_uint(uint64_t x) {{ return x; }}
+
+#ifdef __cplusplus
+constexpr char vsm_log_type(float) {{ return 'd'; }}
+constexpr char vsm_log_type(double) {{ return 'd'; }}
+constexpr char vsm_log_type(bool) {{ return 'u'; }}
+constexpr char vsm_log_type(char) {{ return 'i'; }}
+constexpr char vsm_log_type(signed char) {{ return 'i'; }}
+constexpr char vsm_log_type(short) {{ return 'i'; }}
+constexpr char vsm_log_type(int) {{ return 'i'; }}
+constexpr char vsm_log_type(long) {{ return 'i'; }}
+constexpr char vsm_log_type(long long) {{ return 'i'; }}
+constexpr char vsm_log_type(unsigned char) {{ return 'u'; }}
+constexpr char vsm_log_type(unsigned short) {{ return 'u'; }}
+constexpr char vsm_log_type(unsigned int) {{ return 'u'; }}
+constexpr char vsm_log_type(unsigned long) {{ return 'u'; }}
+constexpr char vsm_log_type(unsigned long long) {{ return 'u'; }}
+static inline uint64_t vsm_log_arg(float x) {{ return vsm_log_dbl(x); }}
+static inline uint64_t vsm_log_arg(double x) {{ return vsm_log_dbl(x); }}
+template <typename T>
+static inline uint64_t vsm_log_arg(T x) {{ return (uint64_t)x; }}
+#define VSM_LOG_TYPE(x) vsm_log_type(x)
+#define VSM_LOG_ARG(x) vsm_log_arg(x)
+#else
+#define VSM_LOG_TYPE(x) _Generic((x), float: 'd', double: 'd', \\
+\t\tunsigned char: 'u', unsigned short: 'u', unsigned int: 'u', \\
+\t\tunsigned long: 'u', unsigned long long: 'u', _Bool: 'u', default: 'i')
+#define VSM_LOG_ARG(x) _Generic((x), float: vsm_log_dbl, double: vsm_log_dbl, \\
+\t\tunsigned char: vsm_log_uint, unsigned short: vsm_log_uint, \\
+\t\tunsigned int: vsm_log_uint, unsigned long: vsm_log_uint, \\
+\t\tunsigned long long: vsm_log_uint, _Bool: vsm_log_uint, \\
+\t\tdefault: vsm_log_int)(x)
+#endif /* __cplusplus */
+
+#define VSM_LOG_SITE_(n, ...) \\
+\t\tstatic const vsm_logfmt vsm_logdesc_ = {{__VA_ARGS__}}; \\
+\t\tvsm_log_write(&vsm_logdesc_, vsm_logargs_)
+
+#define VSM_LOG_0(f) do {{ \\
+\t\tconst uint64_t* vsm_logargs_ = NULL; \\
+\t\tVSM_LOG_SITE_(0, f, 0, {{0}}); }} while (0)
+''')
+
+    # one macro per argument count, dispatched on the number of arguments
+    for n in range(1, 9):
+        params = ', '.join([f'a{i}' for i in range(n)])
+        values = ', '.join([f'VSM_LOG_ARG(a{i})' for i in range(n)])
+        types = ', '.join([f'VSM_LOG_TYPE(a{i})' for i in range(n)])
+        headerdefs[-1] += f'#define VSM_LOG_{n}(f, {params}) do {{ \\\n'
+        headerdefs[-1] += f'\t\tconst uint64_t vsm_logargs_[] = {{{values}}}; \\\n'
+        headerdefs[-1] += f'\t\tVSM_LOG_SITE_({n}, f, {n}, {{{types}}}); }} while (0)\n'
+
+    headerdefs[-1] += '''
+#define VSM_LOG_PICK_(_0, _1, _2, _3, _4, _5, _6, _7, _8, m, ...) m
+#define VSM_LOG(...) VSM_LOG_PICK_(__VA_ARGS__, VSM_LOG_8, VSM_LOG_7, \\
+\t\tVSM_LOG_6, VSM_LOG_5, VSM_LOG_4, VSM_LOG_3, VSM_LOG_2, VSM_LOG_1, \\
+\t\tVSM_LOG_0, 0)(__VA_ARGS__)
+'''
+
+    sourceprelude.append(GNU_SOURCE)
+    sourceincludes.append('#include <pthread.h>\n')
+    sourceincludes.append('#include <stdio.h>\n')
+    sourceincludes.append('#include <stdlib.h> /* getenv() */\n')
+    sourceincludes.append('#include <time.h>\n')
+
+    sourcedefs.append(f'''/* Binary log ring and the thread which writes it to the log file */
+vsm_logring vsm_log __attribute__((aligned(64)));
+static FILE* vsm_logfile;
+static pthread_t vsm_logthread;
+static int vsm_logrunning;
+
+/* Call site descriptors already written to the log file */
+#define VSM_LOG_SEEN_SIZE 4096
+static const vsm_logfmt* vsm_logseen[VSM_LOG_SEEN_SIZE];
+
+static void vsm_LogDefine(const vsm_logfmt* desc) {{
+\tuint64_t id = (uint64_t)(uintptr_t)desc;
+\tuint32_t h = (uint32_t)((id >> 3) * 2654435761u) % VSM_LOG_SEEN_SIZE;
+\tuint32_t probes;
+\tuint32_t len;
+\tuint8_t nargs;
+
+\tfor (probes = 0; probes < VSM_LOG_SEEN_SIZE; ++probes) {{
+\t\tif (vsm_logseen[h] == desc) {{
+\t\t\treturn;
+\t\t}} else if (vsm_logseen[h] == NULL) {{
+\t\t\tvsm_logseen[h] = desc;
+\t\t\tbreak;
+\t\t}}
+\t\th = (h + 1) % VSM_LOG_SEEN_SIZE;
+\t}}
+
+\t/* 'D', ID, argument count, argument types, format length, format */
+\tlen = (uint32_t)strlen(desc->fmt);
+\tnargs = (uint8_t)desc->nargs;
+\tfputc('D', vsm_logfile);
+\tfwrite(&id, sizeof(id), 1, vsm_logfile);
+\tfwrite(&nargs, 1, 1, vsm_logfile);
+\tfwrite(desc->types, 1, nargs, vsm_logfile);
+\tfwrite(&len, sizeof(len), 1, vsm_logfile);
+\tfwrite(desc->fmt, 1, len, vsm_logfile);
+}}
+
+static void* vsm_LogFlush(void* arg) {{
+\tconst struct timespec idle = {{0, 1000000}};
+\tuint64_t dropped = 0;
+\t(void)arg;
+
+\tfor (;;) {{
+\t\tint running = __atomic_load_n(&vsm_logrunning, __ATOMIC_ACQUIRE);
+\t\tuint64_t total = __atomic_load_n(&vsm_log.dropped, __ATOMIC_RELAXED);
+\t\tuint64_t head = __atomic_load_n(&vsm_log.head, __ATOMIC_ACQUIRE);
+\t\tuint64_t tail = vsm_log.tail;
+
+\t\twhile (tail != head) {{
+\t\t\tconst vsm_logfmt* desc = (const vsm_logfmt*)(uintptr_t)
+\t\t\t\t\tvsm_log.ring[tail & (VSM_LOG_RING_WORDS - 1)];
+\t\t\tuint64_t n = 2 + desc->nargs;
+\t\t\tuint64_t i;
+
+\t\t\t/* 'E', ID, timestamp, arguments */
+\t\t\tvsm_LogDefine(desc);
+\t\t\tfputc('E', vsm_logfile);
+\t\t\tfor (i = 0; i < n; ++i) {{
+\t\t\t\tfwrite(&vsm_log.ring[(tail + i) & (VSM_LOG_RING_WORDS - 1)],
+\t\t\t\t\t\tsizeof(uint64_t), 1, vsm_logfile);
+\t\t\t}}
+\t\t\ttail += n;
+\t\t}}
+\t\t__atomic_store_n(&vsm_log.tail, tail, __ATOMIC_RELEASE);
+
+\t\t/* 'L', total number of dropped messages */
+\t\tif (total != dropped) {{
+\t\t\tdropped = total;
+\t\t\tfputc('L', vsm_logfile);
+\t\t\tfwrite(&dropped, sizeof(dropped), 1, vsm_logfile);
+\t\t}}
+
+\t\tif (!running) {{
+\t\t\tbreak;
+\t\t}}
+\t\tfflush(vsm_logfile);
+\t\tnanosleep(&idle, NULL);
+\t}}
+
+\treturn NULL;
+}}
+
+static void vsm_LogOpen(void) {{
+\tconst char* path = getenv("VSMLOG_FILE");
+\tif (path == NULL) {{
+\t\tpath = "{logfile}";
+\t}}
+
+\tvsm_logfile = fopen(path, "wb");
+\tif (vsm_logfile == NULL) {{
+\t\treturn;
+\t}}
+\tfwrite("VSMLOG1", 1, 8, vsm_logfile);
+
+\t__atomic_store_n(&vsm_logrunning, 1, __ATOMIC_RELEASE);
+\tif (pthread_create(&vsm_logthread, NULL, vsm_LogFlush, NULL) != 0) {{
+\t\t__atomic_store_n(&vsm_logrunning, 0, __ATOMIC_RELEASE);
+\t\tfclose(vsm_logfile);
+\t\tvsm_logfile = NULL;
+\t}}
+}}
+
+static void vsm_LogClose(void) {{
+\tif (vsm_logfile == NULL) {{
+\t\treturn;
+\t}}
+\t__atomic_store_n(&vsm_logrunning, 0, __ATOMIC_RELEASE);
+\tpthread_join(vsm_logthread, NULL);
+\tfclose(vsm_logfile);
+\tvsm_logfile = NULL;
+}}
+''')
+
+    inithooks.append('\t/* Start writing the binary log */\n\tvsm_LogOpen();\n')
+    stephooks_pre.append('\tvsm_log.time = timestamp;\n')
+    finalizehooks.append('\t/* Flush and close the binary log */\n\tvsm_LogClose();\n')
+
+def FmtLogDecoder() -> str:
+    """
+    Generate the offline decoder for binary logs written by the code generated
+    by FmtLog().
+
+    :returns: a string containing the decoder script
+
+    """
+    return f'''
+#!/usr/bin/env python3
+
+# Auto-generated decoder for VSM_LOG binary logs.
+#
+# Generated {Timestamp()}
+#
+# Usage: vsmlog_decode.py LOGFILE
+#
+# Prints each logged message as "<timestamp>: <message>".
+
+import re
+import struct
+import sys
+
+# printf conversion specification (length modifiers are dropped, since all
+# arguments are logged as 64-bit values)
+SPEC = re.compile(r'%([-+ #0]*)(\\*|\\d+)?(\\.(?:\\*|\\d*))?' +
+        r'(?:hh|h|ll|l|j|z|t|L|q)?([diouxXeEfFgGaAcp%])')
+
+def ConvertFormat(fmt: str) -> str:
+    """Convert a C format string into a Python %-format string."""
+    def Convert(m):
+        conv = m.group(4)
+        if conv == 'p':
+            return '%#x'
+        elif conv in 'aA':
+            conv = 'e'
+        return '%' + m.group(1) + (m.group(2) or '') + (m.group(3) or '') + conv
+    return SPEC.sub(Convert, fmt)
+
+def Decode(data: bytes):
+    if data[:8] != b'VSMLOG1\\0':
+        sys.exit("error: not a VSM_LOG binary log")
+
+    defs = {{}}
+    dropped = 0
+    pos = 8
+    while pos < len(data):
+        tag = data[pos:pos + 1]
+        pos += 1
+        if tag == b'D':
+            (ident, nargs) = struct.unpack_from('<QB', data, pos)
+            pos += 9
+            types = data[pos:pos + nargs].decode()
+            pos += nargs
+            (length,) = struct.unpack_from('<I', data, pos)
+            pos += 4
+            fmt = data[pos:pos + length].decode(errors='replace')
+            pos += length
+            defs[ident] = (ConvertFormat(fmt), types)
+        elif tag == b'E':
+            (ident, time) = struct.unpack_from('<Qd', data, pos)
+            pos += 16
+            if not ident in defs:
+                sys.exit(f"error: undefined message ID {{ident:#x}}")
+            (fmt, types) = defs[ident]
+            values = []
+            for t in types:
+                if t == 'd':
+                    values += struct.unpack_from('<d', data, pos)
+                elif t == 'u':
+                    values += struct.unpack_from('<Q', data, pos)
+                else:
+                    values += struct.unpack_from('<q', data, pos)
+                pos += 8
+            try:
+                msg = fmt % tuple(values)
+            except (TypeError, ValueError) as e:
+                msg = f'{{fmt!r}} {{values}} (format error: {{e}})'
+            print(f'{{time:.6f}}: {{msg}}')
+        elif tag == b'L':
+            (dropped,) = struct.unpack_from('<Q', data, pos)
+            pos += 8
+        else:
+            sys.exit(f"error: corrupt log at offset {{pos - 1}}")
+
+    if dropped > 0:
+        print(f"warning: {{dropped}} messages were dropped", file=sys.stderr)
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        sys.exit(f"usage: {{sys.argv[0]}} LOGFILE")
+    with open(sys.argv[1], 'rb') as f:
+        Decode(f.read())
+'''
+
+def ChannelBaseName(category: str, channel) -> str:
+    """
+    Get a flat identifier for a channel, used to name signals derived from it
+    (e.g. "category_name").
+
+    """
+    if category == ":default":
+        return channel["name"]
+    if "replica" in channel:
+        return f'{category}{channel["replica"]}_{channel["name"]}'
+    return f'{category}_{channel["name"]}'
+
+def ChannelElements(kind: str, category: str, channel) -> tuple:
+    """
+    Get a C expression (converted to double) for the elements of a channel, in
+    memory order. For vector channels, the expression is indexed by `i` so it
+    can be used in a loop.
+
+    :param kind: "inport", "outport", "signal", or "parameter"
+    :param category: the category of the channel
+    :param channel: the channel object
+    :type channel: dict
+
+    :returns: a tuple of (element count, expression)
+
+    """
+    expr = ChannelExpr(kind, category, channel)
+    ctype = channel.get("type", "double")
+    count = channel["dimX"] * channel["dimY"]
+    cast = '' if ctype == "double" else '(double)'
+    if count == 1:
+        return (1, f'{cast}{expr}')
+    return (count, f'{cast}((const {ctype}*)&{expr})[i]')
+
+def FmtPortCasts(kinds) -> str:
+    """
+    Generate the inports/outports casts at the start of a function taking
+    `const double* inData, const double* outData` arguments.
+
+    :param kinds: the kinds of channels ("inport", "outport", ...) the function
+    refers to
+
+    :returns: the generated declarations (indented, ending with a newline)
+
+    """
+    outstr = ''
+    if "inport" in kinds:
+        outstr += '\tconst Inports* inports = (const Inports*)inData;\n'
+    else:
+        outstr += '\t(void)inData; /* suppress unused variable */\n'
+    if "outport" in kinds:
+        outstr += '\tconst Outports* outports = (const Outports*)outData;\n'
+    else:
+        outstr += '\t(void)outData; /* suppress unused variable */\n'
+    return outstr
+
+def MarkedChannels(data: dict, attr: str) -> list:
+    """
+    Find the inports, outports, and signals with a feature attribute.
+
+    :param data: the dictionary being built by LoadConfig()
+    :param attr: the name of the attribute
+
+    :returns: a list of (kind, category, channel) tuples
+
+    """
+    marked = []
+    for (kind, key) in [("inport", "inports"), ("outport", "outports"),
+            ("signal", "signals")]:
+        for cat in data[key]:
+            for chan in data[key][cat]:
+                if attr in chan:
+                    marked += [(kind, cat, chan)]
+    return marked
+
+def FmtGather(entries: list, array: str) -> str:
+    """
+    Generate code copying (and converting to double) the elements of several
+    channels into one contiguous array, so later passes over the array can be
+    vectorized. The code uses an int32_t loop variable `i`.
+
+    :param entries: list of dictionaries with "kind", "category", "channel",
+    and "offset" (the index of the channel's first element in the array)
+    :param array: the name of the array
+
+    :returns: the generated code (indented, ending with a newline)
+
+    """
+    outstr = ''
+    for e in entries:
+        path = ChannelPath(e["category"], e["channel"])
+        (count, expr) = ChannelElements(e["kind"], e["category"], e["channel"])
+        if count == 1:
+            outstr += f'\t{array}[{e["offset"]}] = {expr}; /* {path} */\n'
+        else:
+            outstr += f'\tfor (i = 0; i < {count}; ++i) {{ /* {path} */\n'
+            outstr += f'\t\t{array}[{e["offset"]} + i] = {expr};\n'
+            outstr += '\t}\n'
+    return outstr
+
+def FmtScatter(entries: list, array: str) -> str:
+    """
+    Generate code copying (and converting from double) the elements of one
+    contiguous array into several outports or signals, the reverse of
+    FmtGather(). The code uses an int32_t loop variable `i`, and outports must
+    be writable.
+
+    :param entries: list of dictionaries with "kind", "category", "channel",
+    and "offset" (the index of the channel's first element in the array)
+    :param array: the name of the array
+
+    :returns: the generated code (indented, ending with a newline)
+
+    """
+    outstr = ''
+    for e in entries:
+        path = ChannelPath(e["category"], e["channel"])
+        expr = ChannelExpr(e["kind"], e["category"], e["channel"])
+        ctype = e["channel"].get("type", "double")
+        cast = '' if ctype == "double" else f'({ctype})'
+        count = e["channel"]["dimX"] * e["channel"]["dimY"]
+        if count == 1:
+            outstr += f'\t{expr} = {cast}{array}[{e["offset"]}]; /* {path} */\n'
+        else:
+            outstr += f'\tfor (i = 0; i < {count}; ++i) {{ /* {path} */\n'
+            outstr += f'\t\t(({ctype}*)&{expr})[i] = {cast}{array}[{e["offset"]} + i];\n'
+            outstr += '\t}\n'
+    return outstr
+
+def ExpandStats(data: dict):
+    """
+    Validate the "stats" attributes of inports, outports, and signals and add
+    the signals publishing their statistics (in the "stats" category), as well
+    as the stats/reset parameter. The published signals point straight into
+    the accumulators updated by the code generated by FmtStats().
+
+    :param data: the dictionary being built by LoadConfig(); a "stats" list
+    describing each marked channel is added to it
+
+    """
+    marked = MarkedChannels(data, "stats")
+
+    data["stats"] = []
+    if len(marked) == 0:
+        return
+
+    if "stats" in data["signals"] or "stats" in data["parameters"]:
+        Die("the 'stats' category is reserved for channel statistics")
+
+    statsigs = [{
+        "name": "count",
+        "dimX": 1,
+        "dimY": 1,
+        "description": "number of samples in the statistics",
+        "type": "double",
+        "addr": '&vsm_stats.count',
+        }]
+    names = set()
+    offset = 0
+    hoffset = 0
+
+    for (kind, cat, chan) in marked:
+        spec = chan["stats"]
+        path = ChannelPath(cat, chan)
+        bins = 0
+        lo = 0.0
+        hi = 0.0
+
+        if isinstance(spec, dict):
+            bins = int(spec.get("bins", 0))
+            if bins < 0:
+                Die(f"{path}: stats bins cannot be negative")
+            if bins > 0:
+                if not "min" in spec or not "max" in spec:
+                    Die(f"{path}: stats histogram requires min and max")
+                lo = float(spec["min"])
+                hi = float(spec["max"])
+                if not lo < hi:
+                    Die(f"{path}: stats min must be less than max")
+        elif spec is not True:
+            if spec is False:
+                continue
+            Die(f"{path}: stats must be true or an object")
+
+        base = ChannelBaseName(cat, chan)
+        if base in names:
+            Die(f"{path}: statistics name {base} is not unique")
+        names.add(base)
+
+        count = chan["dimX"] * chan["dimY"]
+        for stat in ["mean", "var", "min", "max"]:
+            statsigs += [{
+                "name": f'{base}_{stat}',
+                "dimX": chan["dimX"],
+                "dimY": chan["dimY"],
+                "description": f'{stat} of {path}',
+                "type": "double",
+                "addr": f'vsm_stats.{stat} + {offset}',
+                }]
+        if bins > 0:
+            statsigs += [{
+                "name": f'{base}_hist',
+                "dimX": count if count > 1 else bins,
+                "dimY": bins if count > 1 else 1,
+                "description": f'histogram of {path} over [{lo:g}, {hi:g})',
+                "type": "double",
+                "addr": f'vsm_stats.hist + {hoffset}',
+                }]
+
+        data["stats"] += [{
+            "kind": kind,
+            "category": cat,
+            "channel": chan,
+            "offset": offset,
+            "count": count,
+            "bins": bins,
+            "min": lo,
+            "max": hi,
+            "hoffset": hoffset,
+            }]
+        offset += count
+        hoffset += count * bins
+
+    data["signals"]["stats"] = statsigs
+    data["parameters"]["stats"] = [{
+        "name": "reset",
+        "dimX": 1,
+        "dimY": 1,
+        "type": "int32_t",
+        }]
+
+def FmtStats():
+    """
+    Generate the streaming statistics accumulators for the channels described
+    by ExpandStats(). After each step, the samples of all marked channels are
+    gathered into one contiguous array, and a single loop over that array
+    updates the mean/variance (Welford's algorithm), minimum, and maximum of
+    every element, which the compiler can vectorize. Histograms are updated
+    afterwards. Changing the stats/reset parameter to a nonzero value resets
+    the statistics.
+
+    The generated code is added to the header, source, and USER_ function hook
+    lists.
+
+    """
+    size = sum([s["count"] for s in stats])
+    histsize = sum([s["count"] * s["bins"] for s in stats])
+
+    histmember = ''
+    if histsize > 0:
+        histmember = f'\tdouble hist[{histsize}];\n'
+
+    headerdefs.append(f'''
+/* Online statistics of the channels marked with "stats" */
+#define VSM_STATS_SIZE {size}
+typedef struct VsmStats {{
+\tdouble x[VSM_STATS_SIZE]; /* latest samples */
+\tdouble mean[VSM_STATS_SIZE];
+\tdouble m2[VSM_STATS_SIZE]; /* sum of squared differences from the mean */
+\tdouble var[VSM_STATS_SIZE];
+\tdouble min[VSM_STATS_SIZE];
+\tdouble max[VSM_STATS_SIZE];
+{histmember}\tdouble count;
+\tint32_t lastreset;
+}} VsmStats;
+
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+extern VsmStats vsm_stats;
+
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+    histograms = ''
+    for s in stats:
+        path = ChannelPath(s["category"], s["channel"])
+        count = s["count"]
+
+        if s["bins"] > 0:
+            scale = s["bins"] / (s["max"] - s["min"])
+            bins = s["bins"]
+            histograms += f'\tfor (i = 0; i < {count}; ++i) {{ /* {path} */\n'
+            histograms += f'\t\tdouble v = (x[{s["offset"]} + i] - ({s["min"]!r})) * {scale!r};\n'
+            histograms += f'\t\tint32_t b = v >= 0.0 ? (v < {bins}.0 ? (int32_t)v : {bins - 1}) : 0;\n'
+            histograms += f'\t\tvsm_stats.hist[{s["hoffset"]} + i * {bins} + b] += 1.0;\n'
+            histograms += '\t}\n'
+
+    if len(histograms) > 0:
+        histograms = '\n\t/* Histograms (values outside of the range go in the outer bins) */\n' + histograms
+
+    histreset = ''
+    if histsize > 0:
+        histreset = f'''
+\tfor (i = 0; i < {histsize}; ++i) {{
+\t\tvsm_stats.hist[i] = 0.0;
+\t}}'''
+
+    kinds = set([s["kind"] for s in stats])
+
+    sourceincludes.append(MATH_H)
+
+    sourcedefs.append(f'''/* Online statistics of marked channels */
+VsmStats vsm_stats;
+
+static void vsm_StatsReset(void) {{
+\tint32_t i;
+
+\tvsm_stats.count = 0.0;
+\tfor (i = 0; i < VSM_STATS_SIZE; ++i) {{
+\t\tvsm_stats.mean[i] = 0.0;
+\t\tvsm_stats.m2[i] = 0.0;
+\t\tvsm_stats.var[i] = 0.0;
+\t\tvsm_stats.min[i] = HUGE_VAL;
+\t\tvsm_stats.max[i] = -HUGE_VAL;
+\t}}{histreset}
+}}
+
+static void vsm_StatsUpdate(const double* inData, const double* outData) {{
+{FmtPortCasts(kinds)}\tdouble* x = vsm_stats.x;
+\tdouble inv;
+\tdouble varscale;
+\tint32_t i;
+
+\tif (readParam.stats.reset != vsm_stats.lastreset) {{
+\t\tvsm_stats.lastreset = readParam.stats.reset;
+\t\tif (vsm_stats.lastreset != 0) {{
+\t\t\tvsm_StatsReset();
+\t\t}}
+\t}}
+
+\t/* Gather the latest samples */
+{FmtGather(stats, 'x')}
+\t/* Welford's algorithm, minimum, and maximum over all samples at once */
+\tvsm_stats.count += 1.0;
+\tinv = 1.0 / vsm_stats.count;
+\tvarscale = vsm_stats.count > 1.0 ? 1.0 / (vsm_stats.count - 1.0) : 0.0;
+\tfor (i = 0; i < VSM_STATS_SIZE; ++i) {{
+\t\tdouble d = x[i] - vsm_stats.mean[i];
+\t\tvsm_stats.mean[i] += d * inv;
+\t\tvsm_stats.m2[i] += d * (x[i] - vsm_stats.mean[i]);
+\t\tvsm_stats.var[i] = vsm_stats.m2[i] * varscale;
+\t\tvsm_stats.min[i] = x[i] < vsm_stats.min[i] ? x[i] : vsm_stats.min[i];
+\t\tvsm_stats.max[i] = x[i] > vsm_stats.max[i] ? x[i] : vsm_stats.max[i];
+\t}}
+{histograms}}}
+''')
+
+    inithooks.append('\t/* Clear the channel statistics */\n\tvsm_StatsReset();\n')
+    stephooks_post.append('\t/* Update the channel statistics */\n\tvsm_StatsUpdate(inData, outData);\n')
+
+def ExpandEnvelopes(data: dict):
+    """
+    Validate the "envelope" attributes (window lengths in ticks) of inports,
+    outports, and signals and add the signals publishing the min/max/last
+    envelope of each window (in the "envelope" category). The published
+    signals point straight into the arrays updated by the code generated by
+    FmtEnvelopes().
+
+    :param data: the dictionary being built by LoadConfig(); an "envelopes"
+    list of window groups is added to it
+
+    """
+    marked = MarkedChannels(data, "envelope")
+
+    data["envelopes"] = []
+    if len(marked) == 0:
+        return
+
+    if "envelope" in data["signals"]:
+        Die("the 'envelope' category is reserved for channel envelopes")
+
+    # group channels with the same window so each group is one contiguous
+    # range of the envelope arrays
+    groups = {}
+    names = set()
+    for (kind, cat, chan) in marked:
+        path = ChannelPath(cat, chan)
+        window = chan["envelope"]
+        if isinstance(window, bool) or not isinstance(window, int) or window < 1:
+            Die(f"{path}: envelope must be a window length of at least 1 tick")
+
+        base = ChannelBaseName(cat, chan)
+        if base in names:
+            Die(f"{path}: envelope name {base} is not unique")
+        names.add(base)
+
+        if not window in groups:
+            groups[window] = []
+        groups[window] += [(kind, cat, chan)]
+
+    envsigs = []
+    offset = 0
+    for window in sorted(groups):
+        group = {"window": window, "start": offset, "channels": []}
+        for (kind, cat, chan) in groups[window]:
+            path = ChannelPath(cat, chan)
+            base = ChannelBaseName(cat, chan)
+            for stat in ["min", "max", "last"]:
+                envsigs += [{
+                    "name": f'{base}_{stat}',
+                    "dimX": chan["dimX"],
+                    "dimY": chan["dimY"],
+                    "description": f'{stat} of {path} over {window} ticks',
+                    "type": "double",
+                    "addr": f'vsm_envelope.{stat} + {offset}',
+                    }]
+            group["channels"] += [{
+                "kind": kind,
+                "category": cat,
+                "channel": chan,
+                "offset": offset,
+                }]
+            offset += chan["dimX"] * chan["dimY"]
+        group["end"] = offset
+        data["envelopes"] += [group]
+
+    data["signals"]["envelope"] = envsigs
+
+def FmtEnvelopes():
+    """
+    Generate the min/max/last envelope downsampling of the channels described
+    by ExpandEnvelopes(). Every tick, the marked channels are gathered into
+    one contiguous array and the running minimum and maximum of each window
+    group are updated in one vectorizable loop. When a group's window is
+    complete, its envelope is published and the running values restart, so
+    slow consumers see every spike without high-rate logging.
+
+    The generated code is added to the header, source, and USER_ function hook
+    lists.
+
+    """
+    size = envelopes[-1]["end"]
+    ngroups = len(envelopes)
+
+    headerdefs.append(f'''
+/* Min/max/last envelopes of the channels marked with "envelope" */
+#define VSM_ENVELOPE_SIZE {size}
+typedef struct VsmEnvelope {{
+\tdouble x[VSM_ENVELOPE_SIZE]; /* latest samples */
+\tdouble curmin[VSM_ENVELOPE_SIZE]; /* current window */
+\tdouble curmax[VSM_ENVELOPE_SIZE];
+\tdouble min[VSM_ENVELOPE_SIZE]; /* last complete window */
+\tdouble max[VSM_ENVELOPE_SIZE];
+\tdouble last[VSM_ENVELOPE_SIZE];
+\tint32_t ticks[{ngroups}]; /* ticks into the current window of each group */
+}} VsmEnvelope;
+
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+extern VsmEnvelope vsm_envelope;
+
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+    channels = []
+    for g in envelopes:
+        channels += g["channels"]
+    kinds = set([c["kind"] for c in channels])
+
+    windows = ''
+    for (k, g) in enumerate(envelopes):
+        windows += f'''
+\t/* {g["window"]} tick window */
+\tfor (i = {g["start"]}; i < {g["end"]}; ++i) {{
+\t\tcurmin[i] = x[i] < curmin[i] ? x[i] : curmin[i];
+\t\tcurmax[i] = x[i] > curmax[i] ? x[i] : curmax[i];
+\t}}
+\tif (++vsm_envelope.ticks[{k}] >= {g["window"]}) {{
+\t\tvsm_envelope.ticks[{k}] = 0;
+\t\tfor (i = {g["start"]}; i < {g["end"]}; ++i) {{
+\t\t\tvsm_envelope.min[i] = curmin[i];
+\t\t\tvsm_envelope.max[i] = curmax[i];
+\t\t\tvsm_envelope.last[i] = x[i];
+\t\t\tcurmin[i] = HUGE_VAL;
+\t\t\tcurmax[i] = -HUGE_VAL;
+\t\t}}
+\t}}
+'''
+
+    sourceincludes.append(MATH_H)
+
+    sourcedefs.append(f'''/* Envelopes of marked channels */
+VsmEnvelope vsm_envelope;
+
+static void vsm_EnvelopeReset(void) {{
+\tint32_t i;
+
+\tfor (i = 0; i < VSM_ENVELOPE_SIZE; ++i) {{
+\t\tvsm_envelope.curmin[i] = HUGE_VAL;
+\t\tvsm_envelope.curmax[i] = -HUGE_VAL;
+\t}}
+}}
+
+static void vsm_EnvelopeUpdate(const double* inData, const double* outData) {{
+{FmtPortCasts(kinds)}\tdouble* x = vsm_envelope.x;
+\tdouble* curmin = vsm_envelope.curmin;
+\tdouble* curmax = vsm_envelope.curmax;
+\tint32_t i;
+
+\t/* Gather the latest samples */
+{FmtGather(channels, 'x')}{windows}}}
+''')
+
+    inithooks.append('\t/* Start the first envelope windows */\n\tvsm_EnvelopeReset();\n')
+    stephooks_post.append('\t/* Update the channel envelopes */\n\tvsm_EnvelopeUpdate(inData, outData);\n')
+
+def ExpandHistory(data: dict):
+    """
+    Validate the "history" attributes (buffer depths in ticks) of inports,
+    outports, and signals and group the marked channels by depth. Each group
+    is stored as a power-of-two ring of rows, one row per tick holding every
+    channel of the group, by the code generated by FmtHistory().
+
+    :param data: the dictionary being built by LoadConfig(); a "history" list
+    of groups ({"depth", "width", "channels"}) is added to it
+
+    """
+    data["history"] = []
+    groups = {}
+    names = set()
+
+    for (kind, cat, chan) in MarkedChannels(data, "history"):
+        path = ChannelPath(cat, chan)
+        depth = chan["history"]
+        if isinstance(depth, bool) or not isinstance(depth, int) or \
+                depth < 1 or depth & (depth - 1) != 0:
+            Die(f"{path}: history must be a power of two number of ticks")
+
+        base = ChannelBaseName(cat, chan)
+        if base in names:
+            Die(f"{path}: history name {base} is not unique")
+        names.add(base)
+
+        if not depth in groups:
+            groups[depth] = {"depth": depth, "width": 0, "channels": []}
+        group = groups[depth]
+        group["channels"] += [{
+            "kind": kind,
+            "category": cat,
+            "channel": chan,
+            "offset": group["width"],
+            }]
+        group["width"] += chan["dimX"] * chan["dimY"]
+
+    data["history"] = [groups[depth] for depth in sorted(groups)]
+
+def FmtHistory():
+    """
+    Generate the channel history buffers and the VSM_PAST() accessors. After
+    each step, every marked channel is stored into the current row of its
+    group's ring (one contiguous, vectorizable store per channel), so reading
+    a past value only takes a mask of the tick counter, never a modulo.
+
+    The generated code is added to the header, source, and USER_ function hook
+    lists.
+
+    """
+    defs = ''
+    decls = ''
+    for g in history:
+        buf = f'vsm_history{g["depth"]}'
+        decls += f'extern double {buf}[{g["depth"]}][{g["width"]}];\n'
+        for c in g["channels"]:
+            base = ChannelBaseName(c["category"], c["channel"])
+            defs += f'#define VSM_HIST_BUF_{base} {buf}\n'
+            defs += f'#define VSM_HIST_MASK_{base} {g["depth"] - 1}u\n'
+            defs += f'#define VSM_HIST_OFF_{base} {c["offset"]}\n'
+
+    headerdefs.append(f'''
+/*
+ * Channel history. VSM_PAST(ch, k) is the value of scalar channel `ch` k ticks
+ * ago, where 1 <= k <= its history depth and `ch` is the channel's name with
+ * its category (e.g. VSM_PAST(motor_speed, 1) for motor.speed in the previous
+ * tick). VSM_PASTV(ch, k) points to the elements of a vector channel k ticks
+ * ago. Values are stored as doubles after each step.
+ */
+#define VSM_PASTV(ch, k) (&VSM_HIST_BUF_##ch[(vsm_history_pos - (uint32_t)(k)) \\
+\t\t& VSM_HIST_MASK_##ch][VSM_HIST_OFF_##ch])
+#define VSM_PAST(ch, k) (VSM_PASTV(ch, k)[0])
+
+{defs}
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+/* Number of ticks stored so far */
+extern uint32_t vsm_history_pos;
+
+{decls}
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+    kinds = set()
+    stores = ''
+    bufs = ''
+    for g in history:
+        buf = f'vsm_history{g["depth"]}'
+        bufs += f'double {buf}[{g["depth"]}][{g["width"]}] '
+        bufs += '__attribute__((aligned(64)));\n'
+        kinds |= set([c["kind"] for c in g["channels"]])
+        stores += f'\n\t/* {g["depth"]} tick history */\n'
+        stores += f'\tx = {buf}[vsm_history_pos & {g["depth"] - 1}u];\n'
+        stores += FmtGather(g["channels"], 'x')
+
+    resets = ''.join([f'\tmemset(vsm_history{g["depth"]}, 0, ' +
+        f'sizeof(vsm_history{g["depth"]}));\n' for g in history])
+
+    sourceincludes.append(STRING_H)
+
+    sourcedefs.append(f'''/* Channel history rings */
+uint32_t vsm_history_pos;
+{bufs}
+static void vsm_HistoryReset(void) {{
+\tvsm_history_pos = 0;
+{resets}}}
+
+static void vsm_HistoryUpdate(const double* inData, const double* outData) {{
+{FmtPortCasts(kinds)}\tdouble* x;
+\tint32_t i;
+{stores}
+\t(void)i;
+\t++vsm_history_pos;
+}}
+''')
+
+    inithooks.append('\t/* Clear the channel history */\n\tvsm_HistoryReset();\n')
+    stephooks_post.append('\t/* Store this tick in the channel history */\n\tvsm_HistoryUpdate(inData, outData);\n')
+
+# window functions for spectra, in their periodic (DFT-even) forms
+SPECTRUM_WINDOWS = {
+        "rect": None,
+        "hann": lambda n, N: 0.5 - 0.5 * math.cos(2 * math.pi * n / N),
+        "hamming": lambda n, N: 0.54 - 0.46 * math.cos(2 * math.pi * n / N),
+        "blackman": lambda n, N: 0.42 - 0.5 * math.cos(2 * math.pi * n / N) +
+            0.08 * math.cos(4 * math.pi * n / N),
+        }
+
+# largest frame a spectrum can be computed for (its tables are generated)
+SPECTRUM_MAX_FRAME = 65536
+
+def ExpandSpectra(data: dict):
+    """
+    Validate the "spectrum" attributes (window names) of inports, outports,
+    and signals and add the signals publishing the amplitude and phase spectra
+    of each marked channel (in the "spectrum" category). The published signals
+    point straight into the arrays written by the code generated by
+    FmtSpectra().
+
+    :param data: the dictionary being built by LoadConfig(); a "spectra" list
+    describing each marked channel is added to it
+
+    """
+    data["spectra"] = []
+    marked = [m for m in MarkedChannels(data, "spectrum")
+            if m[2]["spectrum"] is not False]
+    if len(marked) == 0:
+        return
+
+    if "spectrum" in data["signals"]:
+        Die("the 'spectrum' category is reserved for channel spectra")
+
+    specsigs = []
+    names = set()
+    offset = 0
+    for (kind, cat, chan) in marked:
+        path = ChannelPath(cat, chan)
+        window = chan["spectrum"]
+        if window is True:
+            window = "rect"
+        if not window in SPECTRUM_WINDOWS:
+            Die(f"{path}: spectrum must be true or a window (" +
+                    f"{', '.join(SPECTRUM_WINDOWS)})")
+
+        frame = chan["dimX"]
+        if chan["dimY"] != 1 or frame < 8 or frame & (frame - 1) != 0 or \
+                frame > SPECTRUM_MAX_FRAME:
+            Die(f"{path}: spectra need a 1D vector with a power of two " +
+                    f"number of elements from 8 to {SPECTRUM_MAX_FRAME}")
+
+        base = ChannelBaseName(cat, chan)
+        if base in names:
+            Die(f"{path}: spectrum name {base} is not unique")
+        names.add(base)
+
+        bins = frame // 2 + 1
+        specsigs += [{
+            "name": f'{base}_mag',
+            "dimX": bins,
+            "dimY": 1,
+            "description": f'amplitude spectrum of {path} ({window} window)',
+            "type": "double",
+            "addr": f'vsm_spectrum.mag + {offset}',
+            }, {
+            "name": f'{base}_phase',
+            "dimX": bins,
+            "dimY": 1,
+            "description": f'phase spectrum of {path} in radians',
+            "type": "double",
+            "addr": f'vsm_spectrum.phase + {offset}',
+            }]
+        data["spectra"] += [{
+            "kind": kind,
+            "category": cat,
+            "channel": chan,
+            "frame": frame,
+            "window": window,
+            "offset": offset,
+            }]
+        offset += bins
+
+    data["signals"]["spectrum"] = specsigs
+
+def FmtFft(frame: int) -> str:
+    """
+    Generate the tables and the function computing the spectrum of a real
+    frame of one length. The frame is packed into a complex array of half its
+    length (even samples as real parts, odd samples as imaginary parts) in
+    bit-reversed order, transformed in place by a radix-4 pass and then
+    radix-2 passes, and finally split into the spectrum of the real frame.
+    The arrays are split into real and imaginary parts and every twiddle
+    factor is precomputed, so each pass is a unit-stride loop the compiler can
+    vectorize.
+
+    :param frame: the frame length (a power of two, at least 8)
+
+    :returns: the generated code
+
+    """
+    n = frame
+    m = n // 2
+    fft = f'vsm_fft{n}'
+    bits = m.bit_length() - 1
+    rev = [int(format(k, f'0{bits}b')[::-1], 2) for k in range(m)]
+
+    # twiddles of the radix-2 passes (half = 4, 8, ..., m / 2), concatenated
+    twr = []
+    twi = []
+    half = 4
+    while half < m:
+        twr += [math.cos(math.pi * j / half) for j in range(half)]
+        twi += [-math.sin(math.pi * j / half) for j in range(half)]
+        half *= 2
+    postc = [math.cos(2 * math.pi * k / n) for k in range(m + 1)]
+    posts = [math.sin(2 * math.pi * k / n) for k in range(m + 1)]
+
+    outstr = f'''/* {n}-point real FFT (as a {m}-point complex FFT) */
+static const int32_t {fft}_rev[{m}] = {FmtInitializer(rev, [m])};
+static const double {fft}_postc[{m + 1}] = {FmtInitializer(postc, [m + 1])};
+static const double {fft}_posts[{m + 1}] = {FmtInitializer(posts, [m + 1])};
+'''
+    passes = ''
+    if len(twr) > 0:
+        outstr += f'''static const double {fft}_twr[{len(twr)}] = {FmtInitializer(twr, [len(twr)])};
+static const double {fft}_twi[{len(twi)}] = {FmtInitializer(twi, [len(twi)])};
+'''
+        passes = f'''
+\t/* Radix-2 passes */
+\tfor (half = 4; half < {m}; half *= 2) {{
+\t\tconst double* wr = {fft}_twr + half - 4;
+\t\tconst double* wi = {fft}_twi + half - 4;
+\t\tfor (k = 0; k < {m}; k += 2 * half) {{
+\t\t\tdouble* ur = re + k;
+\t\t\tdouble* ui = im + k;
+\t\t\tdouble* vr = re + k + half;
+\t\t\tdouble* vi = im + k + half;
+\t\t\tfor (j = 0; j < half; ++j) {{
+\t\t\t\tdouble tr = wr[j] * vr[j] - wi[j] * vi[j];
+\t\t\t\tdouble ti = wr[j] * vi[j] + wi[j] * vr[j];
+\t\t\t\tvr[j] = ur[j] - tr;
+\t\t\t\tvi[j] = ui[j] - ti;
+\t\t\t\tur[j] += tr;
+\t\t\t\tui[j] += ti;
+\t\t\t}}
+\t\t}}
+\t}}
+'''
+    else:
+        passes = '\t(void)j;\n\t(void)half;\n'
+
+    outstr += f'''static double {fft}_re[{m}] __attribute__((aligned(64)));
+static double {fft}_im[{m}] __attribute__((aligned(64)));
+
+/*
+ * Compute the amplitude (scaled by `scale`) and phase spectra of a frame,
+ * windowed by `w` (NULL for no window).
+ */
+static void vsm_Spectrum{n}(const double* x, const double* w, double scale,
+\t\tdouble* mag, double* phase) {{
+\tdouble* re = {fft}_re;
+\tdouble* im = {fft}_im;
+\tint32_t i, j, k, half;
+
+\t/* Pack the windowed frame as complex samples in bit-reversed order */
+\tif (w != NULL) {{
+\t\tfor (i = 0; i < {m}; ++i) {{
+\t\t\tre[{fft}_rev[i]] = w[2 * i] * x[2 * i];
+\t\t\tim[{fft}_rev[i]] = w[2 * i + 1] * x[2 * i + 1];
+\t\t}}
+\t}} else {{
+\t\tfor (i = 0; i < {m}; ++i) {{
+\t\t\tre[{fft}_rev[i]] = x[2 * i];
+\t\t\tim[{fft}_rev[i]] = x[2 * i + 1];
+\t\t}}
+\t}}
+
+\t/* The first two radix-2 passes as one radix-4 pass (twiddles 1 and -i) */
+\tfor (k = 0; k < {m}; k += 4) {{
+\t\tdouble ar = re[k] + re[k + 1], ai = im[k] + im[k + 1];
+\t\tdouble br = re[k] - re[k + 1], bi = im[k] - im[k + 1];
+\t\tdouble cr = re[k + 2] + re[k + 3], ci = im[k + 2] + im[k + 3];
+\t\tdouble dr = re[k + 2] - re[k + 3], di = im[k + 2] - im[k + 3];
+\t\tre[k] = ar + cr;
+\t\tim[k] = ai + ci;
+\t\tre[k + 1] = br + di;
+\t\tim[k + 1] = bi - dr;
+\t\tre[k + 2] = ar - cr;
+\t\tim[k + 2] = ai - ci;
+\t\tre[k + 3] = br - di;
+\t\tim[k + 3] = bi + dr;
+\t}}
+{passes}
+\t/* Split into the spectrum of the real frame (bins 0 to {m}) */
+\tfor (k = 0; k <= {m}; ++k) {{
+\t\tint32_t a = k & {m - 1};
+\t\tint32_t b = ({m} - k) & {m - 1};
+\t\tdouble evr = 0.5 * (re[a] + re[b]);
+\t\tdouble evi = 0.5 * (im[a] - im[b]);
+\t\tdouble odr = 0.5 * (im[a] + im[b]);
+\t\tdouble odi = 0.5 * (re[b] - re[a]);
+\t\tdouble xr = evr + {fft}_postc[k] * odr + {fft}_posts[k] * odi;
+\t\tdouble xi = evi + {fft}_postc[k] * odi - {fft}_posts[k] * odr;
+\t\tmag[k] = scale * sqrt(xr * xr + xi * xi);
+\t\tphase[k] = atan2(xi, xr);
+\t}}
+
+\t/* DC and Nyquist aren't folded from negative frequencies */
+\tmag[0] *= 0.5;
+\tmag[{m}] *= 0.5;
+}}
+
+'''
+    return outstr
+
+def FmtSpectra():
+    """
+    Generate the spectra of the channels described by ExpandSpectra(). After
+    each step, each marked channel is gathered into a frame and transformed by
+    an FFT specialized for its length (see FmtFft()), with the window
+    coefficients and scaling computed at generation time.
+
+    The generated code is added to the header, source, and USER_ function hook
+    lists.
+
+    """
+    bins = sum([s["frame"] // 2 + 1 for s in spectra])
+    maxframe = max([s["frame"] for s in spectra])
+
+    headerdefs.append(f'''
+/* Amplitude and phase spectra of the channels marked with "spectrum" */
+#define VSM_SPECTRUM_BINS {bins}
+typedef struct VsmSpectrum {{
+\tdouble mag[VSM_SPECTRUM_BINS];
+\tdouble phase[VSM_SPECTRUM_BINS];
+\tdouble x[{maxframe}]; /* gathered frame */
+}} VsmSpectrum;
+
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+extern VsmSpectrum vsm_spectrum;
+
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+    ffts = ''
+    for frame in sorted(set([s["frame"] for s in spectra])):
+        ffts += FmtFft(frame)
+
+    windows = ''
+    for (frame, window) in sorted(set([(s["frame"], s["window"])
+            for s in spectra])):
+        fn = SPECTRUM_WINDOWS[window]
+        if fn is None:
+            continue
+        coefs = [fn(k, frame) for k in range(frame)]
+        windows += f'static const double vsm_window{frame}_{window}[{frame}] = '
+        windows += FmtInitializer(coefs, [frame]) + ';\n'
+    if len(windows) > 0:
+        windows = f'/* Window coefficients */\n{windows}\n'
+
+    updates = ''
+    for s in spectra:
+        path = ChannelPath(s["category"], s["channel"])
+        frame = s["frame"]
+        fn = SPECTRUM_WINDOWS[s["window"]]
+        w = 'NULL'
+        gain = frame
+        if fn is not None:
+            w = f'vsm_window{frame}_{s["window"]}'
+            gain = math.fsum([fn(k, frame) for k in range(frame)])
+        entry = {
+                "kind": s["kind"],
+                "category": s["category"],
+                "channel": s["channel"],
+                "offset": 0,
+                }
+        updates += f'\n\t/* {path} */\n'
+        updates += FmtGather([entry], 'x')
+        updates += f'\tvsm_Spectrum{frame}(x, {w}, {repr(2.0 / gain)}, '
+        updates += f'vsm_spectrum.mag + {s["offset"]},\n'
+        updates += f'\t\t\tvsm_spectrum.phase + {s["offset"]});\n'
+
+    kinds = set([s["kind"] for s in spectra])
+
+    sourceincludes.append(MATH_H)
+
+    sourcedefs.append(f'''/* Spectra of marked channels */
+VsmSpectrum vsm_spectrum;
+
+{ffts}{windows}static void vsm_SpectrumUpdate(const double* inData, const double* outData) {{
+{FmtPortCasts(kinds)}\tdouble* x = vsm_spectrum.x;
+\tint32_t i;
+{updates}
+\t(void)i;
+}}
+''')
+
+    stephooks_post.append('\t/* Update the channel spectra */\n\tvsm_SpectrumUpdate(inData, outData);\n')
+
+def BindChannels(owner: str, key: str, refs, data: dict) -> tuple:
+    """
+    Resolve the channels bound to the inputs or outputs of a generated block
+    (e.g. a state-space block), given as "inport:NAME", "outport:NAME", or
+    "signal:NAME" with NAME as in the config.
+
+    :param owner: the block, for error messages (e.g. "state-space block x")
+    :param key: "inputs" or "outputs" (outputs can't be inports, and can't be
+    bound more than once)
+    :param refs: the list of channel references from the config
+    :param data: the dictionary being built by LoadConfig()
+
+    :returns: a tuple of (list of {"kind", "category", "channel", "offset"}
+    dictionaries as used by FmtGather() and FmtScatter(), total number of
+    elements)
+
+    """
+    kinds = {
+            "inport": "inports",
+            "outport": "outports",
+            "signal": "signals",
+            }
+
+    entries = []
+    offset = 0
+    if not isinstance(refs, list) or len(refs) == 0:
+        Die(f"{owner}: {key} must be a non-empty list of channels")
+    for ref in refs:
+        if not isinstance(ref, str) or ref.count(':') != 1:
+            Die(f"{owner}: {ref} must be \"inport:NAME\", \"outport:NAME\", " +
+                    "or \"signal:NAME\"")
+        (kind, target) = ref.split(':')
+        if not kind in kinds or (key == "outputs" and kind == "inport"):
+            Die(f"{owner}: {key} cannot be {kind}s")
+        (cat, chan) = FindChannel(data[kinds[kind]], target)
+        if chan is None:
+            Die(f"{owner}: {kind} {target} does not exist")
+        if "alias" in chan or "lazy" in chan:
+            Die(f"{owner}: {target} is not stored by the model (bind the " +
+                    "channel it's computed from instead)")
+        if key == "outputs" and any([e["channel"] is chan for e in entries]):
+            Die(f"{owner}: {target} is an output more than once")
+        entries += [{
+            "kind": kind,
+            "category": cat,
+            "channel": chan,
+            "offset": offset,
+            }]
+        offset += chan["dimX"] * chan["dimY"]
+    return (entries, offset)
+
+def ParseStateSpace(config: dict, data: dict):
+    """
+    Parse the "statespace" config value: discrete linear state-space blocks
+    x[k+1] = A x[k] + B u[k], y[k] = C x[k] + D u[k], with u gathered from
+    ports or signals and y written to outports or signals. Each block adds a
+    category named after it with the A, B, C, and D matrices as parameters
+    and the state vector as the signal x. This runs before ParseTables(), so
+    tables can initialize the matrices.
+
+    :param config: the config object
+    :param data: the dictionary being built by LoadConfig(); a "statespace"
+    list describing each block is added to it
+
+    """
+    data["statespace"] = []
+
+    for block in config.get("statespace", []):
+        if not isinstance(block, dict) or not "name" in block:
+            Die("unnamed state-space block")
+        name = block["name"]
+        if not isinstance(name, str) or not name.isidentifier():
+            Die(f"state-space block name {name} is not a valid identifier")
+        if name in data["parameters"] or name in data["signals"]:
+            Die(f"state-space block {name}: category {name} already exists")
+
+        states = block.get("states")
+        if isinstance(states, bool) or not isinstance(states, int) or \
+                states < 1:
+            Die(f"state-space block {name}: states must be at least 1")
+
+        owner = f'state-space block {name}'
+        (inputs, m) = BindChannels(owner, "inputs", block.get("inputs"), data)
+        (outputs, p) = BindChannels(owner, "outputs", block.get("outputs"),
+                data)
+        n = states
+
+        x0 = FlattenValues(block.get("x0", [0.0] * n))
+        if len(x0) != n:
+            Die(f"state-space block {name}: x0 must have {n} values")
+
+        # initial matrix values given in the block (the rest are zero, unless
+        # set by tables)
+        shapes = {"A": (n, n), "B": (n, m), "C": (p, n), "D": (p, m)}
+        matrices = {}
+        for (mat, (rows, cols)) in shapes.items():
+            if not mat in block:
+                continue
+            values = FlattenValues(block[mat])
+            if len(values) != rows * cols:
+                Die(f"state-space block {name}: {mat} must be {rows}x{cols}")
+            matrices[mat] = values
+
+        try:
+            x0 = [float(v) for v in x0]
+            for mat in matrices:
+                matrices[mat] = [float(v) for v in matrices[mat]]
+        except (TypeError, ValueError) as e:
+            Die(f"state-space block {name}: invalid value: {e}")
+        if not all([math.isfinite(v) for v in
+                x0 + sum(matrices.values(), [])]):
+            Die(f"state-space block {name}: values must be finite")
+
+        data["parameters"][name] = [{
+            "name": mat,
+            "dimX": rows,
+            "dimY": cols,
+            "type": "double",
+            } for (mat, (rows, cols)) in shapes.items()]
+        data["signals"][name] = [{
+            "name": "x",
+            "dimX": n,
+            "dimY": 1,
+            "description": f'state of {name}',
+            "type": "double",
+            }]
+
+        data["statespace"] += [{
+            "name": name,
+            "states": n,
+            "inputs": inputs,
+            "outputs": outputs,
+            "m": m,
+            "p": p,
+            "x0": x0,
+            "matrices": matrices,
+            }]
+
+def ExpandStateSpace(data: dict):
+    """
+    Add tables initializing the state-space matrices given in the config (see
+    ParseStateSpace()), after ParseTables().
+
+    :param data: the dictionary being built by LoadConfig()
+
+    """
+    initialized = set([t["parameter"] for t in data["tables"]])
+    for ss in data["statespace"]:
+        for (mat, values) in ss["matrices"].items():
+            member = f'{ss["name"]}.{mat}'
+            if member in initialized:
+                Die(f"state-space block {ss['name']}: {mat} is initialized " +
+                        "by both the block and a table")
+            param = [p for p in data["parameters"][ss["name"]]
+                    if p["name"] == mat][0]
+            data["tables"] += [{
+                "name": f'{ss["name"]}_{mat}',
+                "type": "double",
+                "replicas": 1,
+                "dimX": param["dimX"],
+                "dimY": param["dimY"],
+                "values": values,
+                "parameter": member,
+                }]
+
+def FmtStateSpace():
+    """
+    Generate the state-space blocks described by ParseStateSpace(). After each
+    step, each block gathers its inputs after its state into z = [x; u], so
+    both updates are one fixed-size product of the stacked matrix
+    [A B; C D] with z, computed a row at a time. Each row's dot product is
+    split into independent lanes, which the compiler can vectorize without
+    reassociating floating-point sums itself. The outputs are then scattered
+    to their channels and the new state is stored.
+
+    The generated code is added to the header, source, and USER_ function hook
+    lists.
+
+    """
+    lanes = 4
+    blocks = ''
+    resets = ''
+    calls = ''
+    for ss in statespace:
+        name = ss["name"]
+        (n, m, p) = (ss["states"], ss["m"], ss["p"])
+        fn = f'vsm_StateSpace_{name}'
+        kinds = set([e["kind"] for e in ss["inputs"] + ss["outputs"]])
+        inputs = [dict(e, offset=n + e["offset"]) for e in ss["inputs"]]
+        outputs = [dict(e, offset=n + e["offset"]) for e in ss["outputs"]]
+
+        # one lane-split dot product over z for each part of a row
+        dots = ''
+        loopvars = ''
+        if n >= lanes or m >= lanes:
+            loopvars = '\tint32_t j, l;\n\n'
+        for (rowptr, start, count) in [('a', 0, n), ('b', n, m)]:
+            full = count // lanes * lanes
+            if full > 0:
+                dots += f'\tfor (j = 0; j < {full}; j += {lanes}) {{\n'
+                dots += f'\t\tfor (l = 0; l < {lanes}; ++l) {{\n'
+                zidx = f'{start} + j + l' if start > 0 else 'j + l'
+                dots += f'\t\t\ts[l] += {rowptr}[j + l] * z[{zidx}];\n'
+                dots += '\t\t}\n\t}\n'
+            for j in range(full, count):
+                dots += f'\ts[{j % lanes}] += {rowptr}[{j}] * z[{start + j}];\n'
+
+        outstr = f'''/* State-space block {name} ({n} states, {m} inputs, {p} outputs) */
+static double {fn}_z[{n + m}] __attribute__((aligned(64)));
+static double {fn}_y[{n + p}] __attribute__((aligned(64)));
+
+/* One row of [A B; C D] times z */
+static double {fn}_Row(const double* a, const double* b) {{
+\tconst double* z = {fn}_z;
+\tdouble s[{lanes}] = {{0.0, 0.0, 0.0, 0.0}};
+{loopvars}{dots}\treturn (s[0] + s[1]) + (s[2] + s[3]);
+}}
+
+static void {fn}(const double* inData, double* outData) {{
+'''
+        if "inport" in kinds:
+            outstr += '\tconst Inports* inports = (const Inports*)inData;\n'
+        else:
+            outstr += '\t(void)inData; /* suppress unused variable */\n'
+        if "outport" in kinds:
+            outstr += '\tOutports* outports = (Outports*)outData;\n'
+        else:
+            outstr += '\t(void)outData; /* suppress unused variable */\n'
+        outstr += f'''\tconst double* A = (const double*)&readParam.{name}.A;
+\tconst double* B = (const double*)&readParam.{name}.B;
+\tconst double* C = (const double*)&readParam.{name}.C;
+\tconst double* D = (const double*)&readParam.{name}.D;
+\tdouble* x = (double*)&rtSignal.{name}.x;
+\tdouble* z = {fn}_z;
+\tdouble* y = {fn}_y;
+\tint32_t i;
+
+\t/* z = [x; u] */
+\tfor (i = 0; i < {n}; ++i) {{
+\t\tz[i] = x[i];
+\t}}
+{FmtGather(inputs, 'z')}
+\t/* [x\'; y] = [A B; C D] z */
+\tfor (i = 0; i < {n}; ++i) {{
+\t\ty[i] = {fn}_Row(A + i * {n}, B + i * {m});
+\t}}
+\tfor (i = 0; i < {p}; ++i) {{
+\t\ty[{n} + i] = {fn}_Row(C + i * {n}, D + i * {m});
+\t}}
+
+\t/* Outputs and the next state */
+{FmtScatter(outputs, 'y')}\tfor (i = 0; i < {n}; ++i) {{
+\t\tx[i] = y[i];
+\t}}
+}}
+
+'''
+        blocks += outstr
+
+        x0 = FmtInitializer(ss["x0"], [n], 2)
+        resets += f'\t{{ /* {name} */\n'
+        resets += f'\t\tstatic const double x0[{n}] = {x0};\n'
+        resets += f'\t\tmemcpy(&rtSignal.{name}.x, x0, sizeof(x0));\n'
+        resets += '\t}\n'
+        calls += f'\t{fn}(inData, outData);\n'
+
+    sourceincludes.append(STRING_H)
+
+    sourcedefs.append(f'''{blocks}static void vsm_StateSpaceReset(void) {{
+{resets}}}
+
+static void vsm_StateSpaceUpdate(const double* inData, double* outData) {{
+{calls}}}
+''')
+
+    inithooks.append('\t/* Set the initial state-space states */\n\tvsm_StateSpaceReset();\n')
+    stephooks_post.append('\t/* Update the state-space blocks */\n\tvsm_StateSpaceUpdate(inData, outData);\n')
+
+# interpolation methods and end modes of profiles
+PROFILE_INTERPOLATION = ("linear", "cubic")
+PROFILE_MODES = ("hold", "loop")
+
+def ParseProfiles(config: dict, data: dict):
+    """
+    Parse the "profiles" config value: time profiles (setpoints against time)
+    played back before each step. Each profile adds a category named after it
+    with the breakpoint times ("time", [points]) and values ("value",
+    [points][width], one column per profile sharing the breakpoints) as
+    parameters, and the current values as the signal y. This runs before
+    ParseTables(), so tables can initialize the breakpoints.
+
+    :param config: the config object
+    :param data: the dictionary being built by LoadConfig(); a "profiles" list
+    describing each profile is added to it
+
+    """
+    data["profiles"] = []
+
+    for prof in config.get("profiles", []):
+        if not isinstance(prof, dict) or not "name" in prof:
+            Die("unnamed profile")
+        name = prof["name"]
+        if not isinstance(name, str) or not name.isidentifier():
+            Die(f"profile name {name} is not a valid identifier")
+        if name in data["parameters"] or name in data["signals"]:
+            Die(f"profile {name}: category {name} already exists")
+
+        points = prof.get("points")
+        if isinstance(points, bool) or not isinstance(points, int) or \
+                points < 2:
+            Die(f"profile {name}: points must be at least 2")
+        width = prof.get("width", 1)
+        if isinstance(width, bool) or not isinstance(width, int) or width < 1:
+            Die(f"profile {name}: width must be at least 1")
+
+        interp = prof.get("interpolation", "linear")
+        if not interp in PROFILE_INTERPOLATION:
+            Die(f"profile {name}: interpolation must be one of " +
+                    f"{', '.join(PROFILE_INTERPOLATION)}")
+        mode = prof.get("mode", "hold")
+        if not mode in PROFILE_MODES:
+            Die(f"profile {name}: mode must be one of {', '.join(PROFILE_MODES)}")
+
+        outputs = []
+        if "outputs" in prof:
+            (outputs, count) = BindChannels(f'profile {name}', "outputs",
+                    prof["outputs"], data)
+            if count != width:
+                Die(f"profile {name}: outputs have {count} elements, but " +
+                        f"the width is {width}")
+
+        # initial breakpoints given in the profile (the values default to zero
+        # and the times must be given here or by a table)
+        initial = {}
+        for (key, count) in [("time", points), ("values", points * width)]:
+            if not key in prof:
+                continue
+            values = FlattenValues(prof[key])
+            if len(values) != count:
+                Die(f"profile {name}: {key} must have {count} values")
+            try:
+                values = [float(v) for v in values]
+            except (TypeError, ValueError) as e:
+                Die(f"profile {name}: invalid value: {e}")
+            if not all([math.isfinite(v) for v in values]):
+                Die(f"profile {name}: values must be finite")
+            initial[key] = values
+
+        data["parameters"][name] = [{
+            "name": "time",
+            "dimX": points,
+            "dimY": 1,
+            "type": "double",
+            }, {
+            "name": "value",
+            "dimX": points,
+            "dimY": width if width > 1 else 1,
+            "type": "double",
+            }]
+        data["signals"][name] = [{
+            "name": "y",
+            "dimX": width,
+            "dimY": 1,
+            "description": f'value of {name}',
+            "type": "double",
+            }]
+
+        data["profiles"] += [{
+            "name": name,
+            "points": points,
+            "width": width,
+            "interpolation": interp,
+            "mode": mode,
+            "outputs": outputs,
+            "initial": initial,
+            }]
+
+def ExpandProfiles(data: dict):
+    """
+    Add tables initializing the profile breakpoints given in the config (see
+    ParseProfiles()), after ParseTables(), and check that each profile's
+    times are strictly increasing.
+
+    :param data: the dictionary being built by LoadConfig()
+
+    """
+    inits = {t["parameter"]: t for t in data["tables"]
+            if t["parameter"] is not None}
+    for prof in data["profiles"]:
+        name = prof["name"]
+        for (key, param) in [("time", "time"), ("values", "value")]:
+            member = f'{name}.{param}'
+            if not key in prof["initial"]:
+                continue
+            if member in inits:
+                Die(f"profile {name}: {param} is initialized by both the " +
+                        "profile and a table")
+            p = [p for p in data["parameters"][name] if p["name"] == param][0]
+            inits[member] = {
+                "name": f'{name}_{param}',
+                "type": "double",
+                "replicas": 1,
+                "dimX": p["dimX"],
+                "dimY": p["dimY"],
+                "values": prof["initial"][key],
+                "parameter": member,
+                }
+            data["tables"] += [inits[member]]
+
+        if not f'{name}.time' in inits:
+            Die(f"profile {name}: time must be given by the profile or a table")
+        times = FlattenValues(inits[f'{name}.time']["values"])
+        if any([t1 <= t0 for (t0, t1) in zip(times, times[1:])]):
+            Die(f"profile {name}: times must be strictly increasing")
+
+def FmtProfiles():
+    """
+    Generate the playback of the profiles described by ParseProfiles(). Before
+    each step, each profile finds the segment holding the model time with a
+    persistent cursor, which only moves forward (restarting from the first
+    segment if the time goes back, e.g. when a looping profile wraps), so
+    playback takes O(1) amortized time per step instead of a search. The
+    values of all columns are then interpolated in one loop over the columns,
+    which the compiler can vectorize. Cubic interpolation uses Hermite
+    segments with slopes limited like PCHIP (Fritsch-Carlson), so the values
+    don't overshoot between breakpoints.
+
+    The generated code is added to the source and USER_ function hook lists.
+
+    """
+    blocks = ''
+    resets = ''
+    calls = ''
+    for prof in profiles:
+        name = prof["name"]
+        (n, w) = (prof["points"], prof["width"])
+        fn = f'vsm_Profile_{name}'
+
+        outstr = f'''/* Profile {name} ({n} points, {w} wide, {prof["interpolation"]}, {prof["mode"]}) */
+static int32_t {fn}_k; /* cursor: the segment [k, k + 1] holding the time */
+
+static void {fn}(double* outData, double t) {{
+'''
+        if any([e["kind"] == "outport" for e in prof["outputs"]]):
+            outstr += '\tOutports* outports = (Outports*)outData;\n'
+        else:
+            outstr += '\t(void)outData; /* suppress unused variable */\n'
+        outstr += f'''\tconst double* T = readParam.{name}.time;
+\tconst double* V = (const double*)&readParam.{name}.value;
+\tdouble* y = (double*)&rtSignal.{name}.y;
+\tint32_t k = {fn}_k;
+\tint32_t i;
+
+'''
+        if prof["mode"] == "loop":
+            outstr += f'''\t/* Wrap the time into the first period */
+\tif (t >= T[{n - 1}] && T[{n - 1}] > T[0]) {{
+\t\tt = T[0] + fmod(t - T[0], T[{n - 1}] - T[0]);
+\t}}
+
+'''
+        outstr += f'''\t/* Advance the cursor, or restart it if the time went back */
+\tif (t < T[k]) {{
+\t\tk = 0;
+\t}}
+\twhile (k < {n - 2} && t >= T[k + 1]) {{
+\t\t++k;
+\t}}
+\t{fn}_k = k;
+
+\t{{
+\t\tconst double* v0 = V + k * {w};
+\t\tconst double* v1 = v0 + {w};
+\t\tdouble h = T[k + 1] - T[k];
+\t\tdouble u = h > 0.0 ? (t - T[k]) / h : 1.0;
+
+\t\t/* Hold the first and last values outside the breakpoints */
+\t\tu = u < 0.0 ? 0.0 : (u > 1.0 ? 1.0 : u);
+'''
+        if prof["interpolation"] == "linear":
+            outstr += f'''\t\tfor (i = 0; i < {w}; ++i) {{
+\t\t\ty[i] = v0[i] + u * (v1[i] - v0[i]);
+\t\t}}
+\t}}
+'''
+        else:
+            outstr += f'''
+\t\t/* Hermite basis */
+\t\tdouble c00 = (1.0 + 2.0 * u) * (1.0 - u) * (1.0 - u);
+\t\tdouble c10 = u * (1.0 - u) * (1.0 - u) * h;
+\t\tdouble c01 = u * u * (3.0 - 2.0 * u);
+\t\tdouble c11 = u * u * (u - 1.0) * h;
+
+\t\t/* Neighboring segments (the end segments use their own slope) */
+\t\tint32_t first = k == 0;
+\t\tint32_t last = k == {n - 2};
+\t\tconst double* vp = first ? v0 : v0 - {w};
+\t\tconst double* vn = last ? v1 : v1 + {w};
+\t\tdouble hp = first ? h : T[k] - T[k - 1];
+\t\tdouble hn = last ? h : T[k + 2] - T[k + 1];
+
+\t\tif (!(h > 0.0)) {{
+\t\t\tfor (i = 0; i < {w}; ++i) {{
+\t\t\t\ty[i] = v1[i];
+\t\t\t}}
+\t\t}} else {{
+\t\t\tfor (i = 0; i < {w}; ++i) {{
+\t\t\t\tdouble d = (v1[i] - v0[i]) / h;
+\t\t\t\tdouble m0 = first ? d : vsm_ProfileSlope((v0[i] - vp[i]) / hp, d,
+\t\t\t\t\t\thp, h);
+\t\t\t\tdouble m1 = last ? d : vsm_ProfileSlope(d, (vn[i] - v1[i]) / hn,
+\t\t\t\t\t\th, hn);
+\t\t\t\ty[i] = c00 * v0[i] + c10 * m0 + c01 * v1[i] + c11 * m1;
+\t\t\t}}
+\t\t}}
+\t}}
+'''
+        if len(prof["outputs"]) > 0:
+            outstr += f'\n\t/* Outputs */\n{FmtScatter(prof["outputs"], "y")}'
+        outstr += '}\n\n'
+        blocks += outstr
+
+        resets += f'\t{fn}_k = 0;\n'
+        calls += f'\t{fn}(outData, t);\n'
+
+    helpers = ''
+    if any([prof["interpolation"] == "cubic" for prof in profiles]):
+        helpers = '''/*
+ * Slope at a breakpoint between segments with slopes dl and dr and lengths hl
+ * and hr: a weighted harmonic mean of the slopes, or zero at a local extremum,
+ * so the cubic segments don't overshoot (Fritsch-Carlson, like PCHIP)
+ */
+static double vsm_ProfileSlope(double dl, double dr, double hl, double hr) {
+\tdouble wl = 2.0 * hr + hl;
+\tdouble wr = hr + 2.0 * hl;
+\tif (dl * dr <= 0.0) {
+\t\treturn 0.0;
+\t}
+\treturn (wl + wr) / (wl / dl + wr / dr);
+}
+
+'''
+
+    if any([prof["mode"] == "loop" for prof in profiles]):
+        sourceincludes.append(MATH_H)
+
+    sourcedefs.append(f'''{helpers}{blocks}static void vsm_ProfileReset(void) {{
+{resets}}}
+
+static void vsm_ProfileUpdate(double* outData, double t) {{
+{calls}}}
+''')
+
+    inithooks.append('\t/* Rewind the profiles */\n\tvsm_ProfileReset();\n')
+    stephooks_pre.append('\t/* Play back the profiles */\n\tvsm_ProfileUpdate(outData, timestamp);\n')
+
+# highest degree of a linearization polynomial
+POLY_MAX_DEGREE = 15
+
+def ExpandPoly(data: dict):
+    """
+    Validate the "poly" attributes (polynomial coefficients, constant term
+    first) of inports and group the linearized inports by degree. Each group's
+    coefficients become a [degree + 1][elements] parameter in the "poly"
+    category (e.g. poly/deg3), one row per power with one column per inport
+    element, initialized from the config. This runs after ParseTables(), so
+    the coefficients are initialized by tables added here.
+
+    :param data: the dictionary being built by LoadConfig(); a "poly" list of
+    groups ({"degree", "width", "channels"}) is added to it
+
+    """
+    data["poly"] = []
+    groups = {}
+
+    for cat in data["outports"]:
+        for chan in data["outports"][cat]:
+            if "poly" in chan:
+                Die(f"{ChannelPath(cat, chan)}: poly is only supported for " +
+                        "inports")
+
+    for cat in data["inports"]:
+        for chan in data["inports"][cat]:
+            if not "poly" in chan:
+                continue
+            path = ChannelPath(cat, chan)
+            coefs = chan["poly"]
+            if not isinstance(coefs, list) or len(coefs) < 2 or \
+                    len(coefs) > POLY_MAX_DEGREE + 1 or any([
+                        isinstance(c, bool) or
+                        not isinstance(c, (int, float)) or
+                        not math.isfinite(c) for c in coefs]):
+                Die(f"{path}: poly must be a list of 2 to " +
+                        f"{POLY_MAX_DEGREE + 1} coefficients (constant first)")
+
+            degree = len(coefs) - 1
+            if not degree in groups:
+                groups[degree] = {"degree": degree, "width": 0, "channels": []}
+            group = groups[degree]
+            group["channels"] += [{
+                "kind": "inport",
+                "category": cat,
+                "channel": chan,
+                "offset": group["width"],
+                }]
+            group["width"] += chan["dimX"] * chan["dimY"]
+
+    if len(groups) == 0:
+        return
+
+    for ref in ["parameters", "signals"]:
+        if "poly" in data[ref]:
+            Die("the 'poly' category is reserved for inport linearization")
+
+    data["parameters"]["poly"] = []
+    for degree in sorted(groups):
+        group = groups[degree]
+        width = group["width"]
+        data["parameters"]["poly"] += [{
+            "name": f'deg{degree}',
+            "dimX": degree + 1,
+            "dimY": width,
+            "type": "double",
+            }]
+
+        # row k holds the coefficient of x^k for every element
+        values = [0.0] * ((degree + 1) * width)
+        for c in group["channels"]:
+            count = c["channel"]["dimX"] * c["channel"]["dimY"]
+            for (k, coef) in enumerate(c["channel"]["poly"]):
+                for i in range(count):
+                    values[k * width + c["offset"] + i] = float(coef)
+        data["tables"] += [{
+            "name": f'poly_deg{degree}',
+            "type": "double",
+            "replicas": 1,
+            "dimX": degree + 1,
+            "dimY": width,
+            "values": values,
+            "parameter": f'poly.deg{degree}',
+            }]
+        data["poly"] += [group]
+
+def FmtPoly():
+    """
+    Generate the polynomial linearization of the inports described by
+    ExpandPoly(). Before each step, the raw values of each degree group are
+    gathered into one array, every element is evaluated with Horner's scheme
+    in one loop (unrolled over the powers, with the coefficients laid out so
+    every load is unit-stride, so the compiler can vectorize it across
+    elements), and the results are written back to the inports. The hook runs
+    first in USER_TakeOneStep(), so the step function and the other features
+    (including the port aliases) all see the linearized values.
+
+    The generated code is added to the source and USER_ function hook lists.
+
+    """
+    groups = ''
+    for g in poly:
+        (degree, width) = (g["degree"], g["width"])
+        horner = f'\t\tdouble y = c[{degree * width} + i];\n'
+        for k in range(degree - 1, 0, -1):
+            horner += f'\t\ty = y * v + c[{k * width} + i];\n'
+        horner += '\t\ty = y * v + c[i];\n'
+        elements = f'{width} elements' if width > 1 else '1 element'
+        groups += f'''
+\t/* Degree {degree} ({elements}) */
+\tc = (const double*)&readParam.poly.deg{degree};
+{FmtGather(g["channels"], 'x')}\tfor (i = 0; i < {width}; ++i) {{
+\t\tdouble v = x[i];
+{horner}\t\tx[i] = y;
+\t}}
+{FmtScatter(g["channels"], 'x')}'''
+
+    maxwidth = max([g["width"] for g in poly])
+
+    sourcedefs.append(f'''/* Polynomial linearization of the inports with "poly" */
+static double vsm_poly_x[{maxwidth}] __attribute__((aligned(64)));
+
+static void vsm_PolyApply(double* inData) {{
+\tInports* inports = (Inports*)inData;
+\tdouble* x = vsm_poly_x;
+\tconst double* c;
+\tint32_t i;
+{groups}}}
+''')
+
+    stephooks_pre.append('\t/* Linearize the inports */\n\tvsm_PolyApply(inData);\n')
+
+def ExpandDelta(data: dict) -> list:
+    """
+    Validate the "deadband" attributes of outports and signals and add the
+    signals reporting the cost of the change detector generated by FmtDelta()
+    (in the "delta" category). Unlike the other features, this depends on the
+    command line (--delta), so it's applied after the config is loaded (or
+    read from the cache).
+
+    :param data: the dictionary returned by LoadConfig()
+
+    :returns: a list of dictionaries describing each monitored channel, with
+    "kind", "category", "channel", "offset", and "deadband"
+
+    """
+    for (kind, cat, chan) in MarkedChannels(data, "deadband"):
+        path = ChannelPath(cat, chan)
+        deadband = chan["deadband"]
+        if kind == "inport":
+            Die(f"{path}: deadband is only supported for outports and signals")
+        if isinstance(deadband, bool) or \
+                not isinstance(deadband, (int, float)) or deadband < 0:
+            Die(f"{path}: deadband must be a non-negative number")
+
+    if "delta" in data["signals"]:
+        Die("the 'delta' category is reserved for --delta")
+
+    # every outport and every member of Signals (not the signals published by
+    # other features, which point elsewhere)
+    channels = []
+    offset = 0
+    for (kind, key) in [("outport", "outports"), ("signal", "signals")]:
+        for cat in data[key]:
+            for chan in data[key][cat]:
+                if "addr" in chan:
+                    continue
+                channels += [{
+                    "kind": kind,
+                    "category": cat,
+                    "channel": chan,
+                    "offset": offset,
+                    "deadband": float(chan.get("deadband", 0)),
+                    }]
+                offset += chan["dimX"] * chan["dimY"]
+
+    if offset == 0:
+        Die("--delta requires at least one outport or signal")
+
+    data["signals"]["delta"] = [
+        {
+            "name": name,
+            "dimX": 1,
+            "dimY": 1,
+            "description": desc,
+            "type": "double",
+            "addr": f'&vsm_delta_status.{name}',
+        } for (name, desc) in [
+            ("frame_size", "changed elements in the last delta frame"),
+            ("detect_ns", "change detection time of the last step (ns)"),
+            ("detect_max_ns", "maximum change detection time (ns)"),
+            ("dropped", "delta frames dropped because the ring was full"),
+        ]]
+
+    return channels
+
+def FmtDelta():
+    """
+    Generate the report-by-exception change detector. After each step, all
+    outports and signals are gathered into one array and compared against
+    the last reported values in a single vectorizable pass, honoring each
+    channel's deadband. The indices of the changed elements are then
+    compacted and written with their values as one frame into a
+    single-producer/single-consumer ring, which consumers drain with
+    vsm_DeltaRead(). A frame which doesn't fit is dropped without updating the
+    reported values, so its changes are sent with the next frame.
+
+    The generated code is added to the header, source, and USER_ function hook
+    lists.
+
+    """
+    entries = args.delta_ring
+    size = deltas[-1]["offset"] + \
+            deltas[-1]["channel"]["dimX"] * deltas[-1]["channel"]["dimY"]
+    if entries < 64 or entries & (entries - 1) != 0:
+        Die("--delta-ring must be a power of two of at least 64")
+    if entries <= size:
+        Die(f"--delta-ring must be larger than the number of monitored " +
+                f"elements ({size})")
+
+    # the mask is scanned 8 bytes at a time
+    padded = (size + 7) & ~7
+
+    headerdefs.append(f'''
+/*
+ * Report-by-exception export of changed outports and signals.
+ *
+ * After each step, a frame is written to the delta ring: a header entry
+ * (index VSM_DELTA_FRAME, count of entries which follow, model time) followed
+ * by one entry per changed element. Element indices refer to
+ * vsm_delta_names[]. The first frame contains every element.
+ */
+#define VSM_DELTA_SIZE {size}
+#define VSM_DELTA_RING_ENTRIES {entries}
+#define VSM_DELTA_FRAME 0xFFFFFFFFu
+
+typedef struct VsmDeltaEntry {{
+\tuint32_t index; /* element index, or VSM_DELTA_FRAME */
+\tuint32_t count; /* frame header: number of entries in the frame */
+\tdouble value; /* element value, or frame header: model time */
+}} VsmDeltaEntry;
+
+typedef struct VsmDeltaStatus {{
+\tdouble frame_size;
+\tdouble detect_ns;
+\tdouble detect_max_ns;
+\tdouble dropped;
+}} VsmDeltaStatus;
+
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+extern VsmDeltaStatus vsm_delta_status;
+
+/* Names (paths with element indices) of the monitored elements */
+extern const char* const vsm_delta_names[];
+
+/*
+ * Read whole frames from the delta ring (from a single consumer thread).
+ * Returns the number of entries copied to `entries` (at most `max`).
+ */
+int32_t vsm_DeltaRead(VsmDeltaEntry* entries, int32_t max);
+
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+    names = ''
+    deadbands = ''
+    for d in deltas:
+        path = ChannelPath(d["category"], d["channel"])
+        count = d["channel"]["dimX"] * d["channel"]["dimY"]
+        if count == 1:
+            names += f'\t"{path}",\n'
+        else:
+            names += ''.join([f'\t"{path}[{i}]",\n' for i in range(count)])
+        deadbands += f'\t/* {path} */\n'
+        deadbands += f'\t{", ".join([repr(d["deadband"])] * count)},\n'
+
+    namestable = ShardTable('extern const char* const vsm_delta_names[];\n',
+            f'const char* const vsm_delta_names[] = {{\n{names}}};\n', size)
+    deadbandtable = ShardTable(
+            'extern const double vsm_delta_deadband[];\n',
+            f'const double vsm_delta_deadband[] = {{\n{deadbands}}};\n', size)
+
+    kinds = set([d["kind"] for d in deltas])
+
+    sourceprelude.append(GNU_SOURCE)
+    sourceincludes.append(MATH_H)
+    sourceincludes.append(STRING_H)
+    sourceincludes.append('#include <time.h>\n')
+
+    sourcedefs.append(f'''/* Report-by-exception change detector */
+{namestable}
+{deadbandtable}
+#define VSM_DELTA_PADDED {padded}
+
+static struct {{
+\tdouble x[VSM_DELTA_PADDED]; /* latest values */
+\tdouble last[VSM_DELTA_PADDED]; /* last reported values */
+\tuint8_t changed[VSM_DELTA_PADDED];
+\tuint32_t index[VSM_DELTA_SIZE]; /* compacted changed indices */
+\tuint64_t head;
+\tuint64_t tail_cache;
+\tchar pad0_[48];
+\tuint64_t tail; /* consumer side */
+\tchar pad1_[56];
+\tVsmDeltaEntry ring[VSM_DELTA_RING_ENTRIES];
+}} vsm_delta __attribute__((aligned(64)));
+
+VsmDeltaStatus vsm_delta_status;
+
+static void vsm_DeltaReset(void) {{
+\tint32_t i;
+
+\t/* everything differs from HUGE_VAL, so the first frame is complete */
+\tfor (i = 0; i < VSM_DELTA_PADDED; ++i) {{
+\t\tvsm_delta.last[i] = HUGE_VAL;
+\t}}
+}}
+
+static double vsm_DeltaNow(void) {{
+\tstruct timespec ts;
+\tclock_gettime(CLOCK_MONOTONIC, &ts);
+\treturn (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}}
+
+static void vsm_DeltaUpdate(const double* inData, const double* outData,
+\t\tdouble timestamp) {{
+{FmtPortCasts(kinds)}\tdouble* x = vsm_delta.x;
+\tconst double* last = vsm_delta.last;
+\tuint8_t* changed = vsm_delta.changed;
+\tuint32_t* index = vsm_delta.index;
+\tdouble start = vsm_DeltaNow();
+\tdouble elapsed;
+\tuint64_t head = vsm_delta.head;
+\tuint32_t n = 0;
+\tint32_t i;
+
+\t/* Gather the latest values */
+{FmtGather(deltas, 'x')}
+\t/* Compare against the last reported values */
+\tfor (i = 0; i < VSM_DELTA_SIZE; ++i) {{
+\t\tdouble d = x[i] - last[i];
+\t\tchanged[i] = (uint8_t)((d > vsm_delta_deadband[i]) |
+\t\t\t\t(d < -vsm_delta_deadband[i]));
+\t}}
+
+\t/* Compact the changed indices, skipping 8 unchanged elements at a time */
+\tfor (i = 0; i < VSM_DELTA_PADDED; i += 8) {{
+\t\tuint64_t word;
+\t\tint32_t j;
+\t\tmemcpy(&word, &changed[i], sizeof(word));
+\t\tif (word == 0) {{
+\t\t\tcontinue;
+\t\t}}
+\t\tfor (j = i; j < i + 8 && j < VSM_DELTA_SIZE; ++j) {{
+\t\t\tindex[n] = (uint32_t)j;
+\t\t\tn += changed[j];
+\t\t}}
+\t}}
+
+\t/* Write the frame if it fits, otherwise resend the changes next time */
+\tif (head + n + 1 - vsm_delta.tail_cache > VSM_DELTA_RING_ENTRIES) {{
+\t\tvsm_delta.tail_cache = __atomic_load_n(&vsm_delta.tail, __ATOMIC_ACQUIRE);
+\t}}
+\tif (head + n + 1 - vsm_delta.tail_cache > VSM_DELTA_RING_ENTRIES) {{
+\t\tvsm_delta_status.dropped += 1.0;
+\t}} else {{
+\t\tVsmDeltaEntry* frame =
+\t\t\t\t&vsm_delta.ring[head & (VSM_DELTA_RING_ENTRIES - 1)];
+\t\tuint32_t k;
+
+\t\tframe->index = VSM_DELTA_FRAME;
+\t\tframe->count = n;
+\t\tframe->value = timestamp;
+\t\tfor (k = 0; k < n; ++k) {{
+\t\t\tVsmDeltaEntry* e =
+\t\t\t\t\t&vsm_delta.ring[(head + 1 + k) & (VSM_DELTA_RING_ENTRIES - 1)];
+\t\t\te->index = index[k];
+\t\t\te->count = 0;
+\t\t\te->value = x[index[k]];
+\t\t\tvsm_delta.last[index[k]] = x[index[k]];
+\t\t}}
+\t\t__atomic_store_n(&vsm_delta.head, head + n + 1, __ATOMIC_RELEASE);
+\t}}
+
+\telapsed = vsm_DeltaNow() - start;
+\tvsm_delta_status.frame_size = (double)n;
+\tvsm_delta_status.detect_ns = elapsed;
+\tif (elapsed > vsm_delta_status.detect_max_ns) {{
+\t\tvsm_delta_status.detect_max_ns = elapsed;
+\t}}
+}}
+
+int32_t vsm_DeltaRead(VsmDeltaEntry* entries, int32_t max) {{
+\tuint64_t head = __atomic_load_n(&vsm_delta.head, __ATOMIC_ACQUIRE);
+\tuint64_t tail = vsm_delta.tail;
+\tint32_t n = 0;
+
+\twhile (tail != head) {{
+\t\tconst VsmDeltaEntry* frame =
+\t\t\t\t&vsm_delta.ring[tail & (VSM_DELTA_RING_ENTRIES - 1)];
+\t\tuint32_t count = frame->count + 1;
+\t\tuint32_t k;
+
+\t\tif ((int64_t)n + count > max) {{
+\t\t\tbreak;
+\t\t}}
+\t\tfor (k = 0; k < count; ++k) {{
+\t\t\tentries[n++] = vsm_delta.ring[(tail + k) & (VSM_DELTA_RING_ENTRIES - 1)];
+\t\t}}
+\t\ttail += count;
+\t}}
+
+\t__atomic_store_n(&vsm_delta.tail, tail, __ATOMIC_RELEASE);
+\treturn n;
+}}
+''')
+
+    inithooks.append('\t/* Send every element in the first delta frame */\n\tvsm_DeltaReset();\n')
+    stephooks_post.append('\t/* Export changed outports and signals */\n\tvsm_DeltaUpdate(inData, outData, timestamp);\n')
+
+def ExpandMirror(data: dict) -> list:
+    """
+    Assign each non-double member of Signals a slot in the double mirror
+    generated by FmtMirror() (--signal-mirror). The signal's attributes then
+    describe the mirror instead of the member, so VeriStand probes it as a
+    plain double. Like ExpandDelta(), this depends on the command line, so
+    it's applied after the config is loaded.
+
+    :param data: the dictionary returned by LoadConfig()
+
+    :returns: a list of dictionaries describing each mirrored signal, with
+    "kind", "category", "channel", and "offset"
+
+    """
+    mirrored = []
+    offset = 0
+    for cat in data["signals"]:
+        for sig in data["signals"][cat]:
+            if "addr" in sig or sig["type"] == "double":
+                continue
+            sig["mirror"] = offset
+            mirrored += [{
+                "kind": "signal",
+                "category": cat,
+                "channel": sig,
+                "offset": offset,
+                }]
+            offset += sig["dimX"] * sig["dimY"]
+    return mirrored
+
+def FmtMirror():
+    """
+    Generate the double mirror of the non-double signals: one contiguous,
+    aligned array updated by a conversion pass (one vectorizable loop per
+    signal) after each step.
+
+    The generated code is added to the header, source, and USER_ function hook
+    lists.
+
+    """
+    size = mirror[-1]["offset"] + \
+            mirror[-1]["channel"]["dimX"] * mirror[-1]["channel"]["dimY"]
+
+    headerdefs.append(f'''
+/* Double mirror of the non-double signals, updated after each step */
+#define VSM_MIRROR_SIZE {size}
+
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+extern double vsm_mirror[VSM_MIRROR_SIZE];
+
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+    # the gather loops need a loop variable for vector signals
+    loopvar = ''
+    if any([m["channel"]["dimX"] * m["channel"]["dimY"] > 1 for m in mirror]):
+        loopvar = '\tint32_t i;\n'
+
+    sourcedefs.append(f'''/* Double mirror of the non-double signals */
+double vsm_mirror[VSM_MIRROR_SIZE] __attribute__((aligned(64)));
+
+static void vsm_MirrorUpdate(void) {{
+\tdouble* x = vsm_mirror;
+{loopvar}
+{FmtGather(mirror, 'x')}}}
+''')
+
+    stephooks_post.append('\t/* Update the double signal mirror */\n\tvsm_MirrorUpdate();\n')
+
+def FindChannel(valuedata: dict, path: str):
+    """
+    Find a channel by its config name ("name" or "category.name").
+
+    :param valuedata: dictionary mapping categories to lists of channels
+    :param path: the name of the channel
+
+    :returns: a tuple of (category, channel), or (None, None) if there's no
+    such channel
+
+    """
+    (cat, name) = GetCategoryAndName(path)
+    for chan in valuedata.get(cat, []):
+        if chan["name"] == name:
+            return (cat, chan)
+    return (None, None)
+
+def ExpandAliases(data: dict):
+    """
+    Resolve the "alias" attributes of signals. An alias signal isn't a member
+    of Signals; its address points straight at the storage it aliases:
+
+    - "param:NAME", the parameter member of the current read side
+    - "inport:NAME" or "outport:NAME", a member of the model's inports or
+      outports
+    - "symbol:NAME", a variable with external linkage defined by the model
+      implementation (declared in model.h with the signal's type and
+      dimensions)
+
+    Parameter and port aliases take the type and dimensions of their target.
+    Since the parameter read side and the inports/outports buffers are only
+    known at step time, their addresses are refreshed before each step (a
+    pointer store, not a copy) by the code generated by FmtAliases().
+
+    :param data: the dictionary being built by LoadConfig()
+
+    """
+    kinds = {
+            "param": ("parameters", 'readParam.'),
+            "inport": ("inports", 'inports->'),
+            "outport": ("outports", 'outports->'),
+            }
+
+    for cat in data["signals"]:
+        for sig in data["signals"][cat]:
+            if not "alias" in sig:
+                continue
+
+            path = ChannelPath(cat, sig)
+            alias = sig["alias"]
+            for attr in SIGNAL_ATTRS:
+                if attr != "alias" and attr in sig:
+                    Die(f"{path}: alias signals cannot have '{attr}' " +
+                            "(set it on the aliased channel instead)")
+            if not isinstance(alias, str) or alias.count(':') != 1:
+                Die(f"{path}: alias must be \"param:NAME\", " +
+                        "\"inport:NAME\", \"outport:NAME\", or \"symbol:NAME\"")
+
+            (kind, target) = alias.split(':')
+            if kind == "symbol":
+                if not target.isidentifier():
+                    Die(f"{path}: alias symbol {target} is not a valid " +
+                            "identifier")
+                sig["addr"] = f'&{target}'
+                continue
+            elif not kind in kinds:
+                Die(f"{path}: unknown alias kind: {kind}")
+
+            (key, prefix) = kinds[kind]
+            (tcat, tchan) = FindChannel(data[key], target)
+            if tchan is None:
+                Die(f"{path}: aliased {kind} {target} does not exist")
+            if "replica" in tchan:
+                Die(f"{path}: template members cannot be aliased")
+            if (sig["dimX"], sig["dimY"]) != (1, 1) and \
+                    (sig["dimX"], sig["dimY"]) != (tchan["dimX"], tchan["dimY"]):
+                Die(f"{path}: dimensions differ from aliased {kind} {target}")
+
+            sig["dimX"] = tchan["dimX"]
+            sig["dimY"] = tchan["dimY"]
+            sig["type"] = tchan.get("type", "double")
+            sig["stepaddr"] = f'&{prefix}{ChannelMember(tcat, tchan)}'
+            if kind == "param":
+                sig["addr"] = sig["stepaddr"]
+            else:
+                # until the first step, ports read as zero
+                sig["addr"] = 'vsm_alias_none'
+
+def FmtAliases():
+    """
+    Generate the declarations of the symbols aliased by signals and the code
+    refreshing the addresses of parameter and port aliases before each step
+    (see ExpandAliases()).
+
+    The generated code is added to the header, USER_ function hook lists, and
+    skeleton implementation.
+
+    """
+    decls = ''
+    refresh = ''
+    portsize = 0
+    symbols = set()
+    i = 0
+    for cat in signals:
+        for sig in signals[cat]:
+            if "alias" in sig:
+                (kind, target) = sig["alias"].split(':')
+                if kind == "symbol" and not target in symbols:
+                    symbols.add(target)
+                    dims = ''
+                    if sig["dimX"] > 1 or sig["dimY"] > 1:
+                        dims += f'[{sig["dimX"]}]'
+                    if sig["dimY"] > 1:
+                        dims += f'[{sig["dimY"]}]'
+                    path = ChannelPath(cat, sig)
+                    decls += f'extern {sig["type"]} {target}{dims}; ' + \
+                            f'/* {path} */\n'
+                    impldefs.append(f'/* Aliased by {path} (TODO: update it ' +
+                            'from your model) */\n' +
+                            f'{sig["type"]} {target}{dims};\n')
+                if kind in ("inport", "outport"):
+                    portsize = max(portsize, sig["dimX"] * sig["dimY"])
+                if "stepaddr" in sig:
+                    refresh += f'\trtSignalAttribs[{i}].addr = (uintptr_t)'
+                    refresh += f'{sig["stepaddr"]};\n'
+            i += 1
+
+    if len(decls) == 0 and len(refresh) == 0:
+        return
+
+    if portsize > 0:
+        decls += f'extern const double vsm_alias_none[{portsize}];\n'
+        sourcedefs.append('/* Port alias target until the first step */\n' +
+                f'const double vsm_alias_none[{portsize}] = {{0}};\n')
+
+    headerdefs.append(f'''
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+/* Storage aliased by signals */
+{decls}
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+    if len(refresh) > 0:
+        stephooks_pre.append('\t/* Point aliases at this step\'s parameters ' +
+                f'and ports */\n{refresh}')
+
+def ExpandLazy(data: dict):
+    """
+    Resolve the "lazy" attributes of signals. A lazy signal isn't a member of
+    Signals; it's stored in vsm_lazy and filled by the compute function named
+    by the attribute, which is only called when VeriStand reads the signal
+    through USER_GetValueByDataType(), at most once per tick (see FmtLazy()).
+
+    :param data: the dictionary being built by LoadConfig(); a "lazy" list of
+    {"category", "channel", "function"} dictionaries is added to it, one per
+    lazy signal
+
+    """
+    data["lazy"] = []
+    functions = {}
+    for cat in data["signals"]:
+        for sig in data["signals"][cat]:
+            if not "lazy" in sig:
+                continue
+
+            path = ChannelPath(cat, sig)
+            fn = sig["lazy"]
+            for attr in SIGNAL_ATTRS:
+                if attr != "lazy" and attr in sig:
+                    Die(f"{path}: lazy signals cannot have '{attr}'")
+            if "replica" in sig:
+                Die(f"{path}: template members cannot be lazy")
+            if not isinstance(fn, str) or not fn.isidentifier():
+                Die(f"{path}: lazy must be the name of a compute function")
+
+            # signals may share a compute function if they have the same shape
+            shape = (sig["type"], sig["dimX"], sig["dimY"])
+            if functions.setdefault(fn, shape) != shape:
+                Die(f"{path}: compute function {fn} is shared by signals " +
+                        "with different types or dimensions")
+
+            sig["addr"] = f'&vsm_lazy.s{len(data["lazy"])}'
+            data["lazy"] += [{"category": cat, "channel": sig, "function": fn}]
+
+def FmtLazy():
+    """
+    Generate the storage of the lazy signals and the code computing them on
+    demand (see ExpandLazy()). Reads through USER_GetValueByDataType() check
+    whether the pointer falls within vsm_lazy (one compare for other
+    signals), and a lazy signal is computed the first time it's read after
+    each step, so the step never pays for signals nobody is watching.
+
+    The generated code is added to the header, source, USER_ function hook
+    lists, and skeleton implementation.
+
+    """
+    members = ''
+    protos = ''
+    declared = set()
+    compute = ''
+    for (k, entry) in enumerate(lazy):
+        sig = entry["channel"]
+        fn = entry["function"]
+        dims = ''
+        if sig["dimX"] > 1 or sig["dimY"] > 1:
+            dims += f'[{sig["dimX"]}]'
+        if sig["dimY"] > 1:
+            dims += f'[{sig["dimY"]}]'
+        path = ChannelPath(entry["category"], sig)
+        members += f'\t{sig["type"]} s{k}{dims}; /* {path} */\n'
+
+        if not fn in declared:
+            declared.add(fn)
+            if len(dims) == 0:
+                proto = f'void {fn}({sig["type"]}* value)'
+            else:
+                proto = f'void {fn}({sig["type"]} value{dims})'
+            protos += f'{proto};\n'
+            impldefs.append(f'''{proto} {{
+\t/* TODO: Compute the lazy signal {path} here */
+}}
+''')
+
+        arg = f'&vsm_lazy.s{k}' if len(dims) == 0 else f'vsm_lazy.s{k}'
+        compute += f'''\tif (ptr == (const void*)&vsm_lazy.s{k}) {{
+\t\tif (vsm_lazy_stamp[{k}] != vsm_lazy_tick) {{
+\t\t\tvsm_lazy_stamp[{k}] = vsm_lazy_tick;
+\t\t\t{fn}({arg});
+\t\t}}
+\t\treturn;
+\t}}
+'''
+
+    headerdefs.append(f'''
+/* Storage of the lazy signals, computed when they're read */
+typedef struct vsm_lazysignals {{
+{members}}} vsm_lazysignals;
+
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+extern vsm_lazysignals vsm_lazy;
+
+/* Compute functions of the lazy signals, defined by the model implementation */
+{protos}
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+    sourcedefs.append(f'''/* Lazy signals and the tick each was last computed in */
+vsm_lazysignals vsm_lazy;
+static uint64_t vsm_lazy_tick = 1;
+static uint64_t vsm_lazy_stamp[{len(lazy)}];
+
+/* Compute the lazy signal being read, at most once per tick */
+static void vsm_LazyCompute(const void* ptr) {{
+{compute}}}
+''')
+
+    probehooks.append('\t/* Compute lazy signals on demand */\n' +
+            '\tif ((uintptr_t)ptr - (uintptr_t)&vsm_lazy < sizeof(vsm_lazy)) {\n' +
+            '\t\tvsm_LazyCompute(ptr);\n\t}\n')
+    stephooks_post.append('\t/* Lazy signals are stale after each step */\n' +
+            '\t++vsm_lazy_tick;\n')
+
+def ParseTemplates(config: dict, data: dict):
+    """
+    Parse the "templates" config value and add the channels of each replica
+    to the dictionary being built by LoadConfig(). A template's channels are
+    added to the category named after the template, member by member, one
+    entry per replica. Each member is stored as an array indexed by replica
+    (structure of arrays; see FmtChannelsStruct()), so the entries are listed
+    in memory order.
+
+    :param config: the config object
+    :param data: the dictionary being built by LoadConfig(); a "templates"
+    list of {"name", "count"} dictionaries is added to it
+
+    """
+    data["templates"] = []
+    kinds = [
+            ("inports", ParsePorts),
+            ("outports", ParsePorts),
+            ("parameters", ParseParameters),
+            ("signals", ParseSignals),
+            ]
+
+    for template in config.get("templates", []):
+        if not isinstance(template, dict) or not "name" in template:
+            Die("unnamed template")
+        name = template["name"]
+        if not isinstance(name, str) or not name.isidentifier():
+            Die(f"template name {name} is not a valid identifier")
+        if name in [t["name"] for t in data["templates"]]:
+            Die(f"template {name} is defined more than once")
+
+        count = template.get("count")
+        if isinstance(count, bool) or not isinstance(count, int) or count < 1:
+            Die(f"template {name}: count must be at least 1")
+
+        for (key, parse) in kinds:
+            if not key in template:
+                continue
+            if name in data[key]:
+                Die(f"template {name} conflicts with the {name} category " +
+                        f"of {key}")
+
+            members = parse(template[key])
+            if len([cat for cat in members if cat != ":default"]) > 0:
+                Die(f"template {name}: {key} cannot have categories")
+
+            entries = []
+            for member in members.get(":default", []):
+                for replica in range(count):
+                    entry = dict(member)
+                    entry["replica"] = replica
+                    entry["replicas"] = count
+                    entries += [entry]
+            if len(entries) > 0:
+                data[key][name] = entries
+
+        data["templates"] += [{"name": name, "count": count}]
+
+def FmtTemplates():
+    """
+    Generate the replica count and loop helpers of each template.
+
+    The generated code is added to the header.
+
+    """
+    outstr = '''
+/*
+ * Replicated categories. Each member of a template is an array indexed by
+ * replica (e.g. rtSignal.cell.voltage[i] is cell[i]/voltage), so per-replica
+ * logic can be written as one loop over all replicas.
+ */
+'''
+    for t in templates:
+        upper = t["name"].upper()
+        outstr += f'#define VSM_{upper}_COUNT {t["count"]}\n'
+        outstr += f'#define VSM_FOREACH_{upper}(i) '
+        outstr += f'for ((i) = 0; (i) < VSM_{upper}_COUNT; ++(i))\n'
+
+    headerdefs.append(outstr)
+
+def FileHash(path: str) -> str:
+    """
+    Get the SHA-256 digest of a file's contents (empty if it can't be read).
+
+    """
+    try:
+        with open(path, 'rb') as f:
+            return hashlib.sha256(f.read()).hexdigest()
+    except OSError:
+        return ''
+
+# names available to table formulas
+TABLE_FUNCS = {name: getattr(math, name) for name in dir(math)
+        if not name.startswith('_')}
+TABLE_FUNCS.update({"abs": abs, "min": min, "max": max, "round": round,
+    "int": int, "float": float})
+
+def FlattenValues(values) -> list:
+    """
+    Flatten nested lists of table values in row-major order.
+
+    """
+    if isinstance(values, (list, tuple)):
+        flat = []
+        for v in values:
+            flat += FlattenValues(v)
+        return flat
+    return [values]
+
+def ParseTables(config: dict, data: dict, basedir: str):
+    """
+    Parse the "tables" config value and evaluate each table. A table's values
+    are computed at generation time from a Python expression ("formula") of
+    the replica index `r`, the indices `i` and `j`, and the dimensions, or by
+    a Python script ("script", relative to the config file) which sets
+    `values` from the same dimensions. A table either becomes a constant array
+    or, with "parameter", the default value of a parameter.
+
+    :param config: the config object
+    :param data: the dictionary being built by LoadConfig(); a "tables" list
+    is added to it, along with the scripts and the files they depend on
+    ("inputs", a list of (path, SHA-256 digest) tuples used to validate the
+    config cache and listed in the --depfile)
+    :param basedir: the directory scripts are relative to
+
+    """
+    data["tables"] = []
+    data["inputs"] = []
+    names = set()
+
+    for table in config.get("tables", []):
+        if not isinstance(table, dict) or not "name" in table:
+            Die("unnamed table")
+        name = table["name"]
+        if not isinstance(name, str) or not name.isidentifier():
+            Die(f"table name {name} is not a valid identifier")
+        if name in names:
+            Die(f"table {name} is defined more than once")
+        names.add(name)
+
+        # the shape and type come from the parameter being initialized, if any
+        param = None
+        replicas = 1
+        if "parameter" in table:
+            (cat, param) = FindChannel(data["parameters"],
+                    str(table["parameter"]))
+            if param is None:
+                Die(f"table {name}: parameter {table['parameter']} does " +
+                        "not exist")
+            if param.get("replica", 0) > 0:
+                Die(f"table {name}: use the template member without a replica")
+            replicas = param.get("replicas", 1)
+            (dimX, dimY, ctype) = (param["dimX"], param["dimY"], param["type"])
+        else:
+            dimX = int(table.get("dimX", 1))
+            dimY = int(table.get("dimY", 1))
+            ctype = {"double": "double", "i32": "int32_t"}.get(
+                    table.get("type", "double"))
+            if ctype is None:
+                Die(f"table {name}: unknown type: {table['type']}")
+            if dimX < 1 or dimY < 1:
+                Die(f"table {name}: dimensions cannot be less than 1")
+
+        dims = {"replicas": replicas, "dimX": dimX, "dimY": dimY}
+        if "formula" in table and "script" in table:
+            Die(f"table {name}: specify either a formula or a script")
+        elif "formula" in table:
+            try:
+                formula = compile(str(table["formula"]), f'<table {name}>',
+                        'eval')
+                env = dict(TABLE_FUNCS)
+                env.update(dims)
+                values = []
+                for r in range(replicas):
+                    for i in range(dimX):
+                        for j in range(dimY):
+                            env.update({"r": r, "i": i, "j": j})
+                            values += [eval(formula, {"__builtins__": {}}, env)]
+            except Exception as e:
+                Die(f"table {name}: formula failed: {e}")
+        elif "script" in table:
+            path = os.path.abspath(os.path.join(basedir, str(table["script"])))
+            data["inputs"] += [(path, FileHash(path))]
+            try:
+                result = runpy.run_path(path, init_globals=dict(dims))
+            except Exception as e:
+                Die(f"table {name}: script {path} failed: {e}")
+            if not "values" in result:
+                Die(f"table {name}: script {path} did not set values")
+            values = FlattenValues(result["values"])
+
+            # other files the script reads
+            depends = table.get("depends", [])
+            if not isinstance(depends, list) or not all([isinstance(d, str)
+                    for d in depends]):
+                Die(f"table {name}: depends must be a list of paths")
+            for dep in depends:
+                deppath = os.path.abspath(os.path.join(basedir, dep))
+                if not os.path.isfile(deppath):
+                    Die(f"table {name}: {deppath} does not exist")
+                data["inputs"] += [(deppath, FileHash(deppath))]
+        else:
+            Die(f"table {name}: specify a formula or a script")
+
+        if len(values) != replicas * dimX * dimY:
+            Die(f"table {name}: expected {replicas * dimX * dimY} values, " +
+                    f"got {len(values)}")
+        try:
+            if ctype == "double":
+                values = [float(v) for v in values]
+            else:
+                values = [int(v) for v in values]
+        except (TypeError, ValueError) as e:
+            Die(f"table {name}: invalid value: {e}")
+        if not all([math.isfinite(v) for v in values]):
+            Die(f"table {name}: values must be finite")
+
+        data["tables"] += [{
+            "name": name,
+            "type": ctype,
+            "replicas": replicas,
+            "dimX": dimX,
+            "dimY": dimY,
+            "values": values,
+            "parameter": param,
+            }]
+        if param is not None:
+            # the whole member, i.e. all replicas of a template member
+            data["tables"][-1]["parameter"] = f'{cat}.{param["name"]}' \
+                    if cat != ":default" else param["name"]
+
+def FmtInitializer(values: list, shape: list, indent: int = 1) -> str:
+    """
+    Format an array initializer with one level of braces per dimension.
+
+    :param values: the values in row-major order
+    :param shape: the array dimensions, as declared (see TableShape())
+    :param indent: the indentation level of the initializer's contents
+
+    :returns: the initializer (without a trailing newline)
+
+    """
+    if len(shape) == 0:
+        return repr(values[0])
+
+    tabs = '\t' * indent
+    if len(shape) == 1:
+        if len(values) <= 4:
+            return '{' + ', '.join([repr(v) for v in values]) + '}'
+        perline = 4 if isinstance(values[0], float) else 8
+        lines = [', '.join([repr(v) for v in values[k:k + perline]])
+                for k in range(0, len(values), perline)]
+        return '{\n' + ''.join([f'{tabs}{line},\n' for line in lines]) + \
+                '\t' * (indent - 1) + '}'
+
+    stride = len(values) // shape[0]
+    rows = [FmtInitializer(values[k * stride:(k + 1) * stride], shape[1:],
+        indent + 1) for k in range(shape[0])]
+    return '{\n' + ''.join([f'{tabs}{row},\n' for row in rows]) + \
+            '\t' * (indent - 1) + '}'
+
+def TableShape(table: dict) -> list:
+    """
+    Get the array dimensions of a table (like FmtChannelsStruct()).
+
+    """
+    shape = []
+    if table["replicas"] > 1:
+        shape += [table["replicas"]]
+    if table["dimX"] > 1 or table["dimY"] > 1:
+        shape += [table["dimX"]]
+    if table["dimY"] > 1:
+        shape += [table["dimY"]]
+    return shape
+
+def FmtTables():
+    """
+    Generate the constant tables evaluated at generation time (see
+    ParseTables()). Tables with no parameter become `const` arrays, which the
+    linker places in read-only pages shared by every process mapping the
+    model; the others are used by FmtInitParams().
+
+    The generated code is added to the header and source.
+
+    """
+    decls = ''
+    for t in tables:
+        if t["parameter"] is not None:
+            continue
+        dims = ''.join([f'[{d}]' for d in TableShape(t)])
+        decl = f'extern const {t["type"]} {t["name"]}{dims};\n'
+        decls += decl
+        defn = f'const {t["type"]} {t["name"]}{dims} = '
+        defn += FmtInitializer(t["values"], TableShape(t)) + ';\n'
+        sourcedefs.append(f'/* Table {t["name"]} */\n' +
+                ShardTable(decl, defn, len(t["values"])))
+
+    if len(decls) == 0:
+        return
+
+    headerdefs.append(f'''
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+/* Constant tables evaluated at generation time */
+{decls}
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+def FmtInitParams() -> str:
+    """
+    Generate the definition of initParams, the default parameter values, with
+    initializers for the parameters set by tables. The initializer is
+    positional (in the order of FmtChannelsStruct()) so the source is valid C
+    and C++.
+
+    :returns: the definition (ending with a newline)
+
+    """
+    outstr = 'Parameters initParams DataSection(".NIVS.defaultparams")'
+    inits = {t["parameter"]: t for t in tables if t["parameter"] is not None}
+    if len(inits) == 0:
+        return outstr + ';\n'
+
+    outstr += ' = {\n'
+    for (cat, members, _) in ChannelLayout(parameters, "parameter"):
+        indent = 1
+        if cat != ":default":
+            indent = 2
+            outstr += f'\t/* {cat} */ {{\n'
+
+        for param in members:
+            member = param["name"]
+            if cat != ":default":
+                member = f'{cat}.{member}'
+
+            if member in inits:
+                t = inits[member]
+                init = FmtInitializer(t["values"], TableShape(t), indent + 1)
+            else:
+                # one level of braces per dimension, like the tables
+                depth = len(TableShape({"replicas": param.get("replicas", 1),
+                    "dimX": param["dimX"], "dimY": param["dimY"]}))
+                init = '{' * depth + '0' + '}' * depth
+            outstr += '\t' * indent + f'/* {param["name"]} */ {init},\n'
+
+        if cat != ":default":
+            outstr += '\t},\n'
+
+    return outstr + '};\n'
+
+def ParseInitHooks(config: dict) -> tuple:
+    """
+    Parse the "init_hooks" and "init_threads" config values.
+
+    :param config: the config object
+
+    :returns: a tuple of (list of hook function names, thread pool size)
+
+    """
+    hooks = config.get("init_hooks", [])
+    if not isinstance(hooks, list):
+        Die("init_hooks must be a list of function names")
+    for hook in hooks:
+        if not isinstance(hook, str) or not hook.isidentifier():
+            Die(f"init hook {hook} is not a valid identifier")
+    if len(set(hooks)) != len(hooks):
+        Die("init hooks must be unique")
+
+    threads = config.get("init_threads", 4)
+    if isinstance(threads, bool) or not isinstance(threads, int) or \
+            threads < 1:
+        Die("init_threads must be at least 1")
+
+    return (hooks, min(threads, max(len(hooks), 1)))
+
+def ExpandStartup(data: dict):
+    """
+    Add the signals publishing the startup phase times measured by the code
+    generated by FmtStartup() (in the "startup" category). Like
+    ExpandDelta(), this depends on the command line (--startup-profile), so
+    it's applied after the config is loaded.
+
+    :param data: the dictionary returned by LoadConfig()
+
+    """
+    if "startup" in data["signals"]:
+        Die("the 'startup' category is reserved for --startup-profile")
+
+    phases = [
+            ("signal_init_ms", "signal address setup time (ms)"),
+            ("features_ms", "generated feature initialization time (ms)"),
+            ("user_init_ms", f'{data["config"]["name"]}_Initialize() time (ms)'),
+            ("init_hooks_ms", "parallel init hooks time (ms)"),
+            ("total_ms", "USER_Initialize() time (ms)"),
+            ]
+    startup = [{
+        "name": name,
+        "dimX": 1,
+        "dimY": 1,
+        "description": desc,
+        "type": "double",
+        "addr": f'&vsm_startup.{name}',
+        } for (name, desc) in phases]
+
+    for (k, hook) in enumerate(data["inithooks"]):
+        startup += [{
+            "name": f'hook_{hook}_ms',
+            "dimX": 1,
+            "dimY": 1,
+            "description": f'{hook}() time (ms)',
+            "type": "double",
+            "addr": f'vsm_startup.hooks + {k}',
+            }]
+
+    data["signals"]["startup"] = startup
+
+def FmtInitHooks():
+    """
+    Generate the runner for the config's init hooks: independent functions
+    which USER_Initialize() runs after the model's own initialization on
+    a temporary pool of threads (the calling thread included), each thread
+    taking the next hook not yet run. If a thread can't be created, the
+    remaining threads (at least the calling thread) run all of the hooks.
+
+    The generated code is added to the header, source, and skeleton
+    implementation.
+
+    """
+    protos = ''.join([f'int32_t {hook}(void);\n' for hook in inithooks_cfg])
+    impldefs.extend([f'''int32_t {hook}(void) {{
+\t/* TODO: Initialize this part of your model here */
+\treturn NI_OK;
+}}
+''' for hook in inithooks_cfg])
+    headerdefs.append(f'''
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+/*
+ * Independent initialization hooks, run in parallel by USER_Initialize() after
+ * {config["name"]}_Initialize(). Each must return NI_OK on success and must
+ * not depend on any of the others.
+ */
+{protos}
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+    hooks = ''.join([f'\t{{{hook}, "{hook}", 0, 0.0}},\n'
+        for hook in inithooks_cfg])
+
+    sourceprelude.append(GNU_SOURCE)
+    sourceincludes.append('#include <pthread.h>\n')
+    sourceincludes.append('#include <time.h>\n')
+
+    sourcedefs.append(f'''/* Parallel init hooks */
+#define VSM_INIT_HOOKS {len(inithooks_cfg)}
+#define VSM_INIT_THREADS {initthreads}
+
+static struct {{
+\tint32_t (*fn)(void);
+\tconst char* name;
+\tint32_t ret;
+\tdouble ms;
+}} vsm_inithooks[VSM_INIT_HOOKS] = {{
+{hooks}}};
+static int32_t vsm_nextinithook;
+
+static double vsm_InitHookNow(void) {{
+\tstruct timespec ts;
+\tclock_gettime(CLOCK_MONOTONIC, &ts);
+\treturn (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}}
+
+static void* vsm_InitHookWorker(void* arg) {{
+\tint32_t k;
+\t(void)arg;
+
+\twhile ((k = __atomic_fetch_add(&vsm_nextinithook, 1, __ATOMIC_RELAXED))
+\t\t\t< VSM_INIT_HOOKS) {{
+\t\tdouble start = vsm_InitHookNow();
+\t\tvsm_inithooks[k].ret = vsm_inithooks[k].fn();
+\t\tvsm_inithooks[k].ms = vsm_InitHookNow() - start;
+\t}}
+
+\treturn NULL;
+}}
+
+static int32_t vsm_RunInitHooks(void) {{
+\tpthread_t threads[VSM_INIT_THREADS];
+\tint started[VSM_INIT_THREADS] = {{0}};
+\tint32_t ret = NI_OK;
+\tint32_t k;
+
+\tvsm_nextinithook = 0;
+\tfor (k = 1; k < VSM_INIT_THREADS; ++k) {{
+\t\tstarted[k] = pthread_create(&threads[k], NULL, vsm_InitHookWorker,
+\t\t\t\tNULL) == 0;
+\t}}
+\tvsm_InitHookWorker(NULL);
+\tfor (k = 1; k < VSM_INIT_THREADS; ++k) {{
+\t\tif (started[k]) {{
+\t\t\tpthread_join(threads[k], NULL);
+\t\t}}
+\t}}
+
+\tfor (k = 0; k < VSM_INIT_HOOKS; ++k) {{
+\t\tif (vsm_inithooks[k].ret != NI_OK && ret == NI_OK) {{
+\t\t\tret = vsm_inithooks[k].ret;
+\t\t}}
+\t}}
+\treturn ret;
+}}
+''')
+
+def FmtStartup():
+    """
+    Generate the startup phase timers (--startup-profile): the time taken by
+    each phase of USER_Initialize() (see FmtInitialize()) and by each init
+    hook, published as signals and printed as a report to stderr when
+    initialization finishes, so it doesn't mix with what the host prints to
+    stdout.
+
+    The generated code is added to the header and source.
+
+    """
+    nhooks = len(inithooks_cfg)
+    hookarray = f'\tdouble hooks[{nhooks}];\n' if nhooks > 0 else ''
+    hookvar = '\tint32_t k;\n\n' if nhooks > 0 else ''
+
+    headerdefs.append(f'''
+/* Startup phase times in milliseconds (--startup-profile) */
+typedef struct VsmStartup {{
+\tdouble signal_init_ms;
+\tdouble features_ms;
+\tdouble user_init_ms;
+\tdouble init_hooks_ms;
+\tdouble total_ms;
+{hookarray}}} VsmStartup;
+
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+extern VsmStartup vsm_startup;
+
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+''')
+
+    hookreport = ''
+    if nhooks > 0:
+        hookreport = f'''\tfprintf(stderr, "  %-28s %10.3f ms (%d threads)\\n",
+\t\t\t"init hooks", vsm_startup.init_hooks_ms, VSM_INIT_THREADS);
+\tfor (k = 0; k < VSM_INIT_HOOKS; ++k) {{
+\t\tvsm_startup.hooks[k] = vsm_inithooks[k].ms;
+\t\tfprintf(stderr, "    %-26s %10.3f ms\\n", vsm_inithooks[k].name,
+\t\t\t\tvsm_startup.hooks[k]);
+\t}}
+'''
+
+    sourceprelude.append(GNU_SOURCE)
+    sourceincludes.append('#include <stdio.h>\n')
+    sourceincludes.append('#include <time.h>\n')
+
+    sourcedefs.append(f'''/* Startup phase timers */
+VsmStartup vsm_startup;
+
+static double vsm_StartupLap(double* last) {{
+\tstruct timespec ts;
+\tdouble now;
+\tdouble lap;
+
+\tclock_gettime(CLOCK_MONOTONIC, &ts);
+\tnow = (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+\tlap = now - *last;
+\t*last = now;
+\treturn lap;
+}}
+
+static void vsm_StartupReport(int32_t ret) {{
+{hookvar}\tvsm_startup.total_ms = vsm_startup.signal_init_ms +
+\t\t\tvsm_startup.features_ms + vsm_startup.user_init_ms +
+\t\t\tvsm_startup.init_hooks_ms;
+
+\tfprintf(stderr, "{config["name"]} startup%s:\\n",
+\t\t\tret == NI_OK ? "" : " (failed)");
+\tfprintf(stderr, "  %-28s %10.3f ms\\n", "signal addresses",
+\t\t\tvsm_startup.signal_init_ms);
+\tfprintf(stderr, "  %-28s %10.3f ms\\n", "feature init",
+\t\t\tvsm_startup.features_ms);
+\tfprintf(stderr, "  %-28s %10.3f ms\\n", "{config["name"]}_Initialize",
+\t\t\tvsm_startup.user_init_ms);
+{hookreport}\tfprintf(stderr, "  %-28s %10.3f ms\\n", "total",
+\t\t\tvsm_startup.total_ms);
+\tfflush(stderr);
+}}
+''')
+
+def ParsePipeline(config: dict):
+    """
+    Parse the "pipeline" config value: the members of the Stage structure
+    passed from stage A to stage B of a pipelined step, and optionally the
+    CPUs each stage is pinned to.
+
+    :param config: the config object
+
+    :returns: None if the model isn't pipelined, otherwise a dictionary with
+    the parsed "stage" channels and the "cpus" of stages A and B (-1 if not
+    pinned)
+
+    """
+    if not "pipeline" in config:
+        return None
+
+    pipeline = config["pipeline"]
+    if not isinstance(pipeline, dict) or not "stage" in pipeline:
+        Die("pipeline must be an object with a stage member list")
+    stage = ParseChannels(pipeline["stage"], types=True)
+    if CountMembers(stage) == 0:
+        Die("pipeline stage must have at least one member")
+
+    cpus = pipeline.get("cpus", [-1, -1])
+    if not isinstance(cpus, list) or len(cpus) != 2 or \
+            any([isinstance(c, bool) or not isinstance(c, int) or c < -1
+                for c in cpus]):
+        Die("pipeline cpus must be a list of two CPU numbers (-1 to not pin)")
+
+    return {"stage": stage, "cpus": cpus}
+
+def PipelineStageDefs() -> list:
+    """
+    Format the definitions (without a body) of the stage functions which
+    replace <name>_Step() when the model is pipelined.
+
+    :returns: a list of the stage A and stage B function definitions
+
+    """
+    name = config["name"]
+    stagea = f'int32_t {name}_StageA('
+    if len(inports) > 0:
+        stagea += 'const Inports* inports, '
+    stagea += 'Stage* stage, double timestamp)'
+
+    stageb = f'int32_t {name}_StageB(const Stage* stage, '
+    if len(outports) > 0:
+        stageb += 'Outports* outports, '
+    stageb += 'double timestamp)'
+
+    return [stagea, stageb]
+
+def FmtPipeline():
+    """
+    Generate the two-stage step pipeline. Each tick, USER_TakeOneStep() runs
+    stage A of this tick (inports to a Stage) on the calling thread while a
+    worker thread runs stage B of the previous tick (the previous tick's Stage
+    to outports), then waits for stage B. The Stage is double-buffered by tick
+    parity, so the stages never share data, and the worker is handed each
+    tick by spinning on a counter rather than sleeping. If the worker can't
+    be started (or there's only one CPU), stage B runs on the calling thread
+    after stage A.
+
+    The generated code is added to the header, source, and USER_ function hook
+    lists, and replaces the call to <name>_Step().
+
+    """
+    name = config["name"]
+    (cpua, cpub) = pipeline["cpus"]
+
+    headerdefs.append(f'''
+/*
+ * Pipeline stage, written by {name}_StageA() for each tick and read by
+ * {name}_StageB() during the next tick
+ */
+{FmtChannelsStruct(pipeline["stage"], "Stage", types=True)}''')
+
+    inparam = 'const Inports* inports, ' if len(inports) > 0 else ''
+    inarg = 'inports, ' if len(inports) > 0 else ''
+    outparam = 'Outports* outports, ' if len(outports) > 0 else ''
+    outarg = 'outports, ' if len(outports) > 0 else ''
+    outmember = '\tOutports* outports; /* where stage B writes */\n' \
+            if len(outports) > 0 else ''
+    outpost = '\t\tvsm_pipe.outports = outports;\n' if len(outports) > 0 else ''
+    workerout = 'vsm_pipe.outports' if len(outports) > 0 else ''
+    stagebparams = f'uint32_t tick, {outparam}'.rstrip(', ')
+    workerargs = f'tick - 1u, {workerout}'.rstrip(', ')
+    serialargs = f'tick - 1u, {outarg}'.rstrip(', ')
+
+    sourceprelude.append(GNU_SOURCE)
+    sourceincludes.append('#include <pthread.h>\n')
+    sourceincludes.append('#include <sched.h>\n')
+    sourceincludes.append('#include <stdio.h>\n')
+    sourceincludes.append(STRING_H)
+
+    sourcedefs.append(f'''/* Two-stage step pipeline */
+#define VSM_PIPE_A_CPU {cpua}
+#define VSM_PIPE_B_CPU {cpub}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VSM_PIPE_RELAX() __builtin_ia32_pause()
+#else
+#define VSM_PIPE_RELAX() ((void)0)
+#endif
+
+/* Stage buffers by tick parity, each on its own cache lines */
+typedef struct VsmPipeSlot {{
+\tStage stage;
+\tdouble timestamp;
+}} __attribute__((aligned(64))) VsmPipeSlot;
+
+static VsmPipeSlot vsm_pipeslots[2];
+
+static struct {{
+\tpthread_t thread;
+\tint running;     /* the stage B worker is running */
+\tint primed;      /* stage A has filled a stage */
+\tuint32_t tick;   /* next tick to run stage A for */
+\tuint32_t posted; /* last tick handed to the worker */
+\tuint32_t done;   /* last tick finished by the worker */
+\tint32_t quit;
+\tint32_t ret;     /* result of the worker's stage B */
+{outmember}}} vsm_pipe;
+
+static void vsm_PipePin(int cpu, const char* stage) {{
+\tcpu_set_t set;
+
+\tif (cpu < 0) {{
+\t\treturn;
+\t}}
+\tCPU_ZERO(&set);
+\tCPU_SET(cpu, &set);
+\tif (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {{
+\t\tfprintf(stderr, "{name}: failed to pin pipeline stage %s to CPU %d\\n",
+\t\t\t\tstage, cpu);
+\t}}
+}}
+
+static int32_t vsm_PipeStageB({stagebparams}) {{
+\tconst VsmPipeSlot* slot = &vsm_pipeslots[tick & 1u];
+\treturn {name}_StageB(&slot->stage, {outarg}slot->timestamp);
+}}
+
+static void* vsm_PipeWorker(void* arg) {{
+\tuint32_t seen = 0;
+\tuint32_t tick;
+\t(void)arg;
+
+\tvsm_PipePin(VSM_PIPE_B_CPU, "B");
+\tfor (;;) {{
+\t\twhile ((tick = __atomic_load_n(&vsm_pipe.posted, __ATOMIC_ACQUIRE))
+\t\t\t\t== seen) {{
+\t\t\tif (__atomic_load_n(&vsm_pipe.quit, __ATOMIC_RELAXED)) {{
+\t\t\t\treturn NULL;
+\t\t\t}}
+\t\t\tVSM_PIPE_RELAX();
+\t\t}}
+\t\tseen = tick;
+\t\tvsm_pipe.ret = vsm_PipeStageB({workerargs});
+\t\t__atomic_store_n(&vsm_pipe.done, tick, __ATOMIC_RELEASE);
+\t}}
+}}
+
+static void vsm_PipelineStop(void) {{
+\tif (vsm_pipe.running) {{
+\t\t__atomic_store_n(&vsm_pipe.quit, 1, __ATOMIC_RELAXED);
+\t\tpthread_join(vsm_pipe.thread, NULL);
+\t\tvsm_pipe.running = 0;
+\t}}
+}}
+
+/* The stages hand off by spinning, which only pays with a CPU each */
+static int vsm_PipeThreaded(void) {{
+\tcpu_set_t set;
+
+\tif (VSM_PIPE_A_CPU >= 0 && VSM_PIPE_B_CPU >= 0) {{
+\t\treturn VSM_PIPE_A_CPU != VSM_PIPE_B_CPU;
+\t}}
+\t/* The CPUs this process may run on (its affinity mask and cpuset), not
+\t * just the ones online */
+\tif (sched_getaffinity(0, sizeof(set), &set) != 0) {{
+\t\treturn 0;
+\t}}
+\treturn CPU_COUNT(&set) > 1;
+}}
+
+static void vsm_PipelineStart(void) {{
+\tvsm_PipelineStop();
+\tmemset(&vsm_pipe, 0, sizeof(vsm_pipe));
+\tmemset(vsm_pipeslots, 0, sizeof(vsm_pipeslots));
+
+\tif (vsm_PipeThreaded()) {{
+\t\tvsm_pipe.running = pthread_create(&vsm_pipe.thread, NULL,
+\t\t\t\tvsm_PipeWorker, NULL) == 0;
+\t}}
+}}
+
+static int32_t vsm_PipelineStep({inparam}{outparam}double timestamp) {{
+\tuint32_t tick = vsm_pipe.tick++;
+\tVsmPipeSlot* slot = &vsm_pipeslots[tick & 1u];
+\tint32_t ret;
+\tint32_t retb = NI_OK;
+
+\tif (!vsm_pipe.primed) {{
+\t\t/* The first tick has no stage for stage B yet */
+\t\tvsm_PipePin(VSM_PIPE_A_CPU, "A");
+\t}} else if (vsm_pipe.running) {{
+\t\t/* Run stage B of the previous tick alongside stage A of this one */
+{outpost}\t\t__atomic_store_n(&vsm_pipe.posted, tick, __ATOMIC_RELEASE);
+\t}}
+
+\tslot->timestamp = timestamp;
+\tret = {name}_StageA({inarg}&slot->stage, timestamp);
+
+\tif (vsm_pipe.primed) {{
+\t\tif (vsm_pipe.running) {{
+\t\t\twhile (__atomic_load_n(&vsm_pipe.done, __ATOMIC_ACQUIRE) != tick) {{
+\t\t\t\tVSM_PIPE_RELAX();
+\t\t\t}}
+\t\t\tretb = vsm_pipe.ret;
+\t\t}} else {{
+\t\t\tretb = vsm_PipeStageB({serialargs});
+\t\t}}
+\t}}
+\tvsm_pipe.primed = 1;
+
+\treturn ret != NI_OK ? ret : retb;
+}}
+''')
+
+    inithooks.append('\t/* Start the pipeline\'s stage B worker */\n\tvsm_PipelineStart();\n')
+    finalizehooks.append('\t/* Stop the pipeline\'s stage B worker */\n\tvsm_PipelineStop();\n')
+
+def FmtInitialize() -> str:
+    """
+    Generate USER_Initialize(): signal address setup, feature initialization
+    hooks, the model's own initialization, and then the config's init hooks
+    (if any). With --startup-profile, each phase is timed.
+
+    :returns: the generated function
+
+    """
+    name = config["name"]
+    profile = args.startup_profile
+    if not profile and len(inithooks_cfg) == 0:
+        return f'''int32_t USER_Initialize(void) {{{FmtSignalInit(signals)}{FmtHooks(inithooks)}
+\treturn {name}_Initialize();
+}}
+'''
+
+    outstr = 'int32_t USER_Initialize(void) {\n\tint32_t ret;\n'
+    if profile:
+        outstr += '\tdouble t = 0.0;\n\n\t/* Start timing the startup phases */\n'
+        outstr += '\tvsm_StartupLap(&t);\n'
+    outstr += FmtSignalInit(signals)
+    if profile:
+        outstr += '\tvsm_startup.signal_init_ms = vsm_StartupLap(&t);\n'
+    if len(inithooks) > 0:
+        outstr += FmtHooks(inithooks)
+        if profile:
+            outstr += '\tvsm_startup.features_ms = vsm_StartupLap(&t);\n'
+
+    outstr += f'\n\tret = {name}_Initialize();\n'
+    if profile:
+        outstr += '\tvsm_startup.user_init_ms = vsm_StartupLap(&t);\n'
+
+    if len(inithooks_cfg) > 0:
+        outstr += '\n\t/* Run the independent init hooks in parallel */\n'
+        outstr += '\tif (ret == NI_OK) {\n\t\tret = vsm_RunInitHooks();\n\t}\n'
+        if profile:
+            outstr += '\tvsm_startup.init_hooks_ms = vsm_StartupLap(&t);\n'
+
+    if profile:
+        outstr += '\n\tvsm_StartupReport(ret);\n'
+
+    return outstr + '\n\treturn ret;\n}\n'
+
+def LoadConfig(text: str, basedir: str) -> dict:
+    """
+    Parse and validate the JSON model config.
+
+    :param text: the contents of the config file
+    :param basedir: the directory files referenced by the config are relative
+    to
+
+    :returns: a dictionary containing the config itself ("config"), the
+    parsed inports, outports, parameters, and signals, the channels with
+    statistics ("stats"), the envelope window groups ("envelopes"), the
+    history groups ("history"), the channels with spectra ("spectra"), the
+    state-space blocks ("statespace"), the time profiles ("profiles"), the
+    linearized inports grouped by degree ("poly"), the lazy signals ("lazy"),
+    the templates ("templates"), the evaluated tables ("tables") and the files
+    they were read from ("inputs"), the init hooks ("inithooks") and their
+    thread pool size ("initthreads"), and the step pipeline ("pipeline", None
+    if the step isn't pipelined)
+
+    """
+    config = json.loads(text)
+
+    if not "name" in config:
+        Die("config does not define a model name")
+    else:
+        if not str(config["name"]).isidentifier():
+            Die("model name is not a valid identifier")
+
+    if not "builder" in config:
+        Die("config does not define a model builder")
+    if not "baserate" in config:
+        Die("config does not define a model baserate")
+
+    data = {
+            "config": config,
+            "inports": {},
+            "outports": {},
+            "parameters": {},
+            "signals": {},
+            }
+    if "inports" in config:
+        data["inports"] = ParsePorts(config["inports"])
+    if "outports" in config:
+        data["outports"] = ParsePorts(config["outports"])
+    if "parameters" in config:
+        data["parameters"] = ParseParameters(config["parameters"])
+    if "signals" in config:
+        data["signals"] = ParseSignals(config["signals"])
+
+    ParseTemplates(config, data)
+    ParseStateSpace(config, data)
+    ParseProfiles(config, data)
+    ParseTables(config, data, basedir)
+    ExpandStateSpace(data)
+    ExpandProfiles(data)
+    ExpandPoly(data)
+    (data["inithooks"], data["initthreads"]) = ParseInitHooks(config)
+    data["pipeline"] = ParsePipeline(config)
+
+    ExpandLazy(data)
+    ExpandAliases(data)
+    ExpandStats(data)
+    ExpandEnvelopes(data)
+    ExpandHistory(data)
+    ExpandSpectra(data)
+
+    return data
+
+def ConfigCachePath(text: str) -> str:
+    """
+    Get the path of the cache file for a config. The cache is keyed by the
+    contents of the config, the generator version, and the contents of the
+    generator itself, so editing either one invalidates it.
+
+    :param text: the contents of the config file
+
+    :returns: the path of the cache file
+
+    """
+    key = hashlib.sha256()
+    key.update(VERSION.encode())
+    with open(os.path.realpath(__file__), 'rb') as f:
+        key.update(f.read())
+    key.update(text.encode())
+
+    cachedir = args.cache_dir
+    if len(cachedir) == 0:
+        cachedir = os.path.join(args.root_dir, ".vsmodelgen-cache")
+    return os.path.join(cachedir, key.hexdigest() + ".pickle")
+
+def ReadConfigCache(path: str):
+    """
+    Read a parsed config from the cache.
+
+    :param path: the path of the cache file
+
+    :returns: the dictionary stored by WriteConfigCache(), or None if the
+    config isn't cached or any of the files it was read from changed
+
+    """
+    try:
+        with open(path, 'rb') as f:
+            data = pickle.load(f)
+    except FileNotFoundError:
+        return None
+    except Exception as e:
+        Warn(f"ignoring unreadable config cache {path}: {e}")
+        return None
+
+    for (inpath, digest) in data.get("inputs", []):
+        if FileHash(inpath) != digest:
+            Vprint(f"{inpath} changed, ignoring cached config")
+            return None
+    return data
+
+def WriteConfigCache(path: str, data: dict):
+    """
+    Store a parsed config in the cache. The file is written atomically so
+    concurrent runs never see a partial cache file.
+
+    :param path: the path of the cache file
+    :param data: the dictionary returned by LoadConfig()
+
+    """
+    try:
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        tmppath = f'{path}.{os.getpid()}.tmp'
+        with open(tmppath, 'wb') as f:
+            pickle.dump(data, f, protocol=pickle.HIGHEST_PROTOCOL)
+        os.replace(tmppath, path)
+    except OSError as e:
+        Warn(f"failed to write config cache {path}: {e}")
+
+
+# data taken from the config
+modeldata = None
+if args.cache:
+    cachepath = ConfigCachePath(configtext)
+    modeldata = ReadConfigCache(cachepath)
+    if modeldata is None:
+        Vprint("config is not cached, parsing it")
+    else:
+        Vprint("using cached config", cachepath)
+
+if modeldata is None:
+    modeldata = LoadConfig(configtext, configdir)
+    if args.cache:
+        WriteConfigCache(cachepath, modeldata)
+
+config = modeldata["config"]
+inports = modeldata["inports"]
+outports = modeldata["outports"]
+parameters = modeldata["parameters"]
+signals = modeldata["signals"]
+stats = modeldata["stats"]
+envelopes = modeldata["envelopes"]
+history = modeldata["history"]
+spectra = modeldata["spectra"]
+statespace = modeldata["statespace"]
+profiles = modeldata["profiles"]
+poly = modeldata["poly"]
+lazy = modeldata["lazy"]
+templates = modeldata["templates"]
+tables = modeldata["tables"]
+inithooks_cfg = modeldata["inithooks"]
+initthreads = modeldata["initthreads"]
+pipeline = modeldata["pipeline"]
+baserate = float(config["baserate"])
+
+deltas = []
+if args.gen_delta:
+    deltas = ExpandDelta(modeldata)
+
+mirror = []
+if args.gen_mirror:
+    mirror = ExpandMirror(modeldata)
+
+if args.startup_profile:
+    ExpandStartup(modeldata)
+
+# access counts from --heat, used to order the channel structures
+heat = None
+if len(args.heat) > 0:
+    heat = LoadHeat(args.heat)
+    known = set()
+    for (kind, valuedata) in [("signal", signals), ("parameter", parameters)]:
+        for cat in valuedata:
+            known |= set([(kind, ChannelPath(cat, v)) for v in valuedata[cat]])
+    stale = len([key for key in heat if not key in known])
+    if stale > 0:
+        Warn(f"{stale} channels in {args.heat} aren't in the model (was it " +
+                "profiled with an older config?)")
+
+Vprint(f'model name: {config["name"]}')
+Vprint(f'model builder: {config["builder"]}')
+Vprint(f'model baserate: {config["baserate"]}')
+
+outimplfile = os.path.join(srcdir, config["name"] + '.c')
+if len(args.outimplfile) > 0:
+    outimplfile = os.path.join(srcdir, args.outimplfile)
+
+if args.gen_impl:
+    Vprint("output boilerplate file path:", outimplfile)
+    if os.path.exists(outimplfile):
+        print(f"{outimplfile} exists and will NOT be overwritten!")
+        args.gen_impl = False
+
+# code contributed by optional features, spliced into the generated header and
+# source (each entry ends with a newline)
+sourceprelude = []   # model source feature test macros, before any includes
+headerincludes = []  # model.h includes
+headerdefs = []      # model.h definitions, after the model's structures
+sourceincludes = []  # model source includes
+sourcedefs = []      # model source definitions, before the USER_ functions
+inithooks = []       # USER_Initialize(), before <name>_Initialize()
+stephooks_pre = []   # USER_TakeOneStep(), before <name>_Step()
+stephooks_post = []  # USER_TakeOneStep(), after <name>_Step()
+finalizehooks = []   # USER_Finalize(), after <name>_Finalize()
+probehooks = []      # USER_GetValueByDataType(), before reading the value
+impldefs = []        # skeleton implementation (--impl), after the USER_ hooks
+
+if len(templates) > 0:
+    FmtTemplates()
+if len(tables) > 0:
+    FmtTables()
+# the inports are linearized before anything else reads them (aliases too)
+if len(poly) > 0:
+    FmtPoly()
+FmtAliases()
+if len(lazy) > 0:
+    FmtLazy()
+if len(statespace) > 0:
+    FmtStateSpace()
+if len(profiles) > 0:
+    FmtProfiles()
+if args.gen_log:
+    FmtLog()
+if len(stats) > 0:
+    FmtStats()
+if len(envelopes) > 0:
+    FmtEnvelopes()
+if len(history) > 0:
+    FmtHistory()
+if len(spectra) > 0:
+    FmtSpectra()
+if args.gen_delta:
+    FmtDelta()
+if len(mirror) > 0:
+    FmtMirror()
+if len(inithooks_cfg) > 0:
+    FmtInitHooks()
+if args.startup_profile:
+    FmtStartup()
+if pipeline is not None:
+    FmtPipeline()
+
+# generate an include guard based on the name of the model
+incguard = f'{str(config["name"]).upper()}_MODEL_H'
+
+if args.gen_header:
+    Vprint(f"using {incguard} as model.h include guard")
+
+# contents of the model.h file
+output_model_h = f'''
+/*
+ * Auto-generated VeriStand model types for {config["name"]}.
+ *
+ * Generated {Timestamp()}
+ *
+ * You almost certainly do NOT want to edit this file, as it may be overwritten
+ * at any time!
+ */
+
+#ifndef {incguard}
+#define {incguard}
+
+#include <stdint.h>
+{''.join(dict.fromkeys(headerincludes))}
+/* Parameters structure */
+{FmtParametersStruct(parameters)}
+
+/* Parameters are defined by NI model interface code */
+/* Use readParam to access parameters */
+extern Parameters rtParameter[2];
+extern int32_t READSIDE;
+#define readParam rtParameter[READSIDE]
+'''
+
+# add inports and outports only if applicable
+inportsstruct = f'''
+/* Inports structure */
+{FmtPortsStruct(inports, "Inports")}
+'''
+if len(inports) > 0:
+    output_model_h += inportsstruct
+
+outportsstruct = f'''
+/* Outports structure */
+{FmtPortsStruct(outports, "Outports")}
+'''
+if len(outports) > 0:
+    output_model_h += outportsstruct
+
+signalsstruct = f'''
+/* Signals structure */
+{FmtSignalsStruct(signals)}
+
+/* Model signals */
+extern Signals rtSignal;
+'''
+if CountMembers(signals) > 0:
+    output_model_h += signalsstruct
+
+for defs in headerdefs:
+    output_model_h += '\n' + defs
+
+output_model_h += f'''
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+/* Your model code should define these functions. Return NI_OK or NI_ERROR. */
+int32_t {config["name"]}_Initialize(void);
+int32_t {config["name"]}_Start(void);'''
+
+# model step function definition
+stepfuncdef = f'int32_t {config["name"]}_Step('
+if len(inports) > 0:
+    stepfuncdef += 'const Inports* inports, '
+if len(outports) > 0:
+    stepfuncdef += 'Outports* outports, '
+stepfuncdef += 'double timestamp)'
+
+# a pipelined model defines its two stages instead of the step function
+stepfuncdefs = [stepfuncdef]
+if pipeline is not None:
+    stepfuncdefs = PipelineStageDefs()
+stepprotos = ''.join([f'{d};\n' for d in stepfuncdefs])
+
+output_model_h += f'''
+{stepprotos}int32_t {config["name"]}_Finalize(void);
+
+#ifdef __cplusplus
+}} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* {incguard} */
+'''
+
+# definitions contributed by optional features, each followed by a blank line
+sourcedefstext = ''.join([d + '\n' for d in sourcedefs])
+
+# model source contents
+output_model_src = f'''
+/*
+ * Auto-generated VeriStand model interface code for {config["name"]}.
+ *
+ * Generated {Timestamp()}
+ *
+ * You almost certainly do NOT want to edit this file, as it may be overwritten
+ * at any time!
+ */
+{FmtPrelude(sourceprelude)}
+#include "ni_modelframework.h"
+#include "model.h"
+
+#include <stddef.h> /* offsetof() */
+{''.join(dict.fromkeys(sourceincludes))}
+/* User-defined data types for parameters and signals */
+#define rtDBL 0
+#define rtINT 1
+
+#ifdef __cplusplus
+extern "C" {{
+#endif /* __cplusplus */
+
+/* Model info */
+const char* USER_ModelName DataSection(".NIVS.compiledmodelname") =
+\t\t"{config["name"]}";
+const char* USER_Builder DataSection(".NIVS.builder") =
+\t\t"{config["builder"]}";
+
+
+/* Model baserate */
+double USER_BaseRate = {baserate};
+
+/* Model task configuration */
+NI_Task rtTaskAttribs DataSection(".NIVS.tasklist") = {{0, {baserate}, 0, 0}};
+
+
+/* Parameters */
+{FmtParamList(parameters)}
+
+/* Signals */
+{FmtSignalList(signals)}
+
+/* Inports and outports */
+{FmtExtIOList(inports, outports)}
+
+{FmtShardDecls(signals)}{sourcedefstext}int32_t USER_SetValueByDataType(void* ptr, int32_t idx, double value,
+\t\tint32_t type) {{
+\tswitch (type) {{
+\t\tcase rtDBL:
+\t\t\t((double*)ptr)[idx] = (double)value;
+\t\t\treturn NI_OK;
+\t\tcase rtINT:
+\t\t\t((int32_t*)ptr)[idx] = (int32_t)value;
+\t\t\treturn NI_OK;
+\t}}
+
+\treturn NI_ERROR;
+}}
+
+double USER_GetValueByDataType(void* ptr, int32_t idx, int32_t type) {{{FmtHooks(probehooks)}
+\tswitch (type) {{
+\t\tcase rtDBL:
+\t\t\treturn ((double*)ptr)[idx];
+\t\tcase rtINT:
+\t\t\treturn (double)(((int32_t*)ptr)[idx]);
+\t}}
+
+\t/* Return NaN on error */
+\tstatic const uint64_t nan = ~(uint64_t)0;
+\treturn *(const double*)&nan;
+}}
+
+{FmtInitialize()}
+int32_t USER_ModelStart(void) {{
+\treturn {config["name"]}_Start();
+}}
+
+int32_t USER_TakeOneStep(double* inData, double* outData, double timestamp) {{
+'''
+
+inportscast = 'const struct Inports* inports = (const struct Inports*)inData;\n'
+outportscast = 'struct Outports* outports = (struct Outports*)outData;\n'
+if len(inports) > 0:
+    output_model_src += '\t' + inportscast
 else:
     output_model_src += '\t(void)inData; /* suppress unused variable */\n'
 
@@ -907,24 +7269,69 @@ if len(outports) > 0:
 else:
     output_model_src += '\t(void)outData; /* suppress unused variable */\n'
 
-output_model_src += f'''
-\treturn {config["name"]}_Step('''
+output_model_src += FmtHooks(stephooks_pre)
+
+stepcall = f'{config["name"]}_Step('
+if pipeline is not None:
+    stepcall = 'vsm_PipelineStep('
 if len(inports) > 0:
-    output_model_src += 'inports, '
+    stepcall += 'inports, '
 if len(outports) > 0:
-    output_model_src += 'outports, '
-output_model_src += f'''timestamp);
+    stepcall += 'outports, '
+stepcall += 'timestamp)'
+
+if len(stephooks_post) == 0:
+    output_model_src += f'''
+\treturn {stepcall};
+}}
+'''
+else:
+    output_model_src += f'''
+\tint32_t ret = {stepcall};
+{FmtHooks(stephooks_post)}
+\treturn ret;
 }}
+'''
 
+if len(finalizehooks) == 0:
+    output_model_src += f'''
 int32_t USER_Finalize(void) {{
 \treturn {config["name"]}_Finalize();
 }}
+'''
+else:
+    output_model_src += f'''
+int32_t USER_Finalize(void) {{
+\tint32_t ret = {config["name"]}_Finalize();
+{FmtHooks(finalizehooks)}
+\treturn ret;
+}}
+'''
 
+output_model_src += f'''
 #ifdef __cplusplus
 }} /* extern "C" */
 #endif /* __cplusplus */
 '''
 
+# skeleton step function (or pipeline stages)
+stepimpls = f'''{stepfuncdef} {{
+\t/* TODO: Perform model steps here */
+\treturn NI_OK;
+}}
+'''
+if pipeline is not None:
+    stepimpls = f'''{stepfuncdefs[0]} {{
+\t/* TODO: Pre-process this tick's inputs into the stage here */
+\treturn NI_OK;
+}}
+
+{stepfuncdefs[1]} {{
+\t/* TODO: Compute the previous tick's outputs from the stage here */
+\treturn NI_OK;
+}}
+'''
+
 output_model_impl = f'''
 /*
  * Implementation of {config["name"]}.
@@ -952,16 +7359,12 @@ int32_t {config["name"]}_Start(void) {{
 \treturn NI_OK;
 }}
 
-{stepfuncdef} {{
-\t/* TODO: Perform model steps here */
-\treturn NI_OK;
-}}
-
+{stepimpls}
 int32_t {config["name"]}_Finalize(void) {{
 \t/* TODO: Cleanup your model here */
 \treturn NI_OK;
 }}
-
+{FmtHooks(impldefs)}
 #ifdef __cplusplus
 }} /* extern "C" */
 #endif /* __cplusplus */
@@ -976,38 +7379,46 @@ else:
 # destinations (either files or stdout) if they are enabled
 if args.gen_header:
     output_model_h = Expand(output_model_h)
-    linecount = len(output_model_h.splitlines())
-    if args.stdout:
-        print(output_model_h, file=sys.stdout)
-    else:
-        print(output_model_h, file=open(outheaderfile, 'w'))
-        print(f"wrote {linecount} lines to {outheaderfile}")
+    WriteOutput(outheaderfile, output_model_h)
 
 if args.gen_src:
     output_model_src = Expand(output_model_src)
-    linecount = len(output_model_src.splitlines())
-    if args.stdout:
-        print(output_model_src, file=sys.stdout)
-    else:
-        print(output_model_src, file=open(outsrcfile, 'w'))
-        print(f"wrote {linecount} lines to {outsrcfile}")
+    WriteOutput(outsrcfile, output_model_src)
+
+    for (path, output_shard_src) in zip(outshardfiles, FmtShards()):
+        output_shard_src = Expand(output_shard_src)
+        WriteOutput(path, output_shard_src)
+
+    # shards left over from a previous run with more shards would be compiled
+    # into the model as well and cause duplicate definitions (like the other
+    # outputs, they're only removed with -f)
+    if not args.stdout:
+        k = args.shards
+        while os.path.exists(f'{outsrcstem}_shard{k}{outsrcext}'):
+            path = f'{outsrcstem}_shard{k}{outsrcext}'
+            with open(path) as f:
+                generated = "Auto-generated" in f.read(256)
+            if generated and args.force:
+                os.remove(path)
+                print(f"{path} is a stale shard and was removed (-f)")
+            elif generated:
+                Warn(f"{path} looks like a stale shard, remove it manually " +
+                        "(or use -f to remove it)")
+            else:
+                Warn(f"{path} looks like a stale shard, remove it manually")
+            k += 1
 
 if args.gen_impl:
     output_model_impl = Expand(output_model_impl)
-    linecount = len(output_model_impl.splitlines())
-    if args.stdout:
-        print(output_model_impl, file=sys.stdout)
+    WriteOutput(outimplfile, output_model_impl)
+
+if args.source_dir == "":
+    if len(args.outdir) == 0:
+        args.source_dir = "."
     else:
-        print(output_model_impl, file=open(outimplfile, 'w'))
-        print(f"wrote {linecount} lines to {outimplfile}")
+        args.source_dir = args.outdir
 
 if args.gen_makefile:
-    if args.source_dir == "":
-        if len(args.outdir) == 0:
-            args.source_dir = "."
-        else:
-            args.source_dir = args.outdir
-
     sources = ""
     for ext in ['c', 'cpp', 'cc', 'cxx']:
         sources += f' $(wildcard {args.source_dir}/*.{ext})'
@@ -1097,12 +7508,7 @@ if args.gen_makefile:
     """
 
     makefile = textwrap.dedent(makefile).strip()
-    linecount = len(makefile.splitlines())
-    if args.stdout:
-        print(makefile, file=sys.stdout)
-    else:
-        print(makefile, file=open(outmakefile, 'w'))
-        print(f"wrote {linecount} lines to {outmakefile}")
+    WriteOutput(outmakefile, makefile)
 
     if args.gen_make_bat:
         makebat = f"""
@@ -1125,9 +7531,217 @@ if args.gen_makefile:
         """
 
         makebat = textwrap.dedent(makebat).strip()
-        linecount = len(makebat.splitlines())
-        if args.stdout:
-            print(makebat, file=sys.stdout)
-        else:
-            print(makebat, file=open(outmakebat, 'w'))
-            print(f"wrote {linecount} lines to {outmakebat}")
+        WriteOutput(outmakebat, makebat)
+
+if args.gen_cmake:
+    # -std= versions (after the "c" or "gnu" prefix, including the old names
+    # of each standard) and the CMake standards they select
+    C_STANDARDS = {"89": "90", "90": "90", "99": "99", "9x": "99", "11": "11",
+            "1x": "11", "17": "17", "18": "17", "2x": "23", "23": "23"}
+    CXX_STANDARDS = {"++98": "98", "++03": "98", "++11": "11", "++0x": "11",
+            "++14": "14", "++1y": "14", "++17": "17", "++1z": "17",
+            "++20": "20", "++2a": "20", "++23": "23", "++2b": "23",
+            "++26": "26", "++2c": "26"}
+
+    def CMakeStd(option: str, std: str, standards: dict) -> (str, str):
+        """
+        Split a -std= value (e.g. gnu11) into a CMake standard and whether
+        compiler extensions are enabled.
+
+        :param option: the option giving the value (for errors)
+        :param std: the -std= value
+        :param standards: the CMake standard of each -std= version
+
+        :returns: a tuple of the CMake standard and "ON" if GNU extensions
+        are enabled (otherwise "OFF")
+
+        """
+        ext = std.startswith("gnu")
+        version = std[3:] if ext else std[1:] if std.startswith("c") else std
+        if not version in standards:
+            Die(f"{option} {std} has no CMake equivalent (known: " +
+                    ", ".join([f'c{v}' for v in standards]) + ")")
+        return (standards[version], "ON" if ext else "OFF")
+
+    (cstd, cext) = CMakeStd("--cstd", args.cstd, C_STANDARDS)
+    (cxxstd, cxxext) = CMakeStd("--cxxstd", args.cxxstd, CXX_STANDARDS)
+
+    sources = ""
+    for ext in ['c', 'cpp', 'cc', 'cxx']:
+        sources += f'\n        "${{PROJECT_SOURCE_DIR}}/{args.source_dir}/*.{ext}"'
+
+    includes = ""
+    for inc in args.include_dirs:
+        includes += f'\n        "{inc}"'
+
+    budget = args.perf_budget
+    if budget <= 0.0:
+        budget = baserate * 1e6
+
+    cmakelists = f"""
+    # Auto-generated CMake project for {config["name"]}.
+    #
+    # Generated {Timestamp()}
+    #
+    # Configure with one of the presets in CMakePresets.json, e.g.
+    #
+    #   cmake --preset nilrt && cmake --build --preset nilrt
+    #   cmake --preset host && cmake --build --preset host --target perf-check
+
+    cmake_minimum_required(VERSION 3.20)
+
+    project({config["name"]} LANGUAGES C CXX)
+
+    set(VERISTAND_VERSION {args.veristand_version} CACHE STRING
+        "VeriStand version to build against")
+    set(VERISTAND_DIR "C:/VeriStand/${{VERISTAND_VERSION}}/ModelInterface"
+        CACHE PATH "VeriStand model interface directory (ni_modelframework.h)")
+
+    set(VSM_PERF_TICKS {args.perf_ticks} CACHE STRING
+        "number of ticks run by the perf-check target")
+    set(VSM_PERF_BUDGET_US {budget:g} CACHE STRING
+        "mean step time (us) above which the perf-check target fails")
+
+    set(CMAKE_C_STANDARD {cstd})
+    set(CMAKE_C_EXTENSIONS {cext})
+    set(CMAKE_CXX_STANDARD {cxxstd})
+    set(CMAKE_CXX_EXTENSIONS {cxxext})
+
+    file(GLOB MODEL_SOURCES CONFIGURE_DEPENDS{sources})
+
+    set(NIVS_SRC "${{VERISTAND_DIR}}/custom/src/ni_modelframework.c")
+    set_source_files_properties("${{NIVS_SRC}}" PROPERTIES
+        COMPILE_DEFINITIONS _XOPEN_SOURCE=700
+        COMPILE_OPTIONS -w)
+
+    # the model itself (lib{config["name"]}64.so)
+    add_library(model SHARED ${{MODEL_SOURCES}} "${{NIVS_SRC}}")
+    set_target_properties(model PROPERTIES
+        OUTPUT_NAME {config["name"]}64
+        C_VISIBILITY_PRESET protected
+        CXX_VISIBILITY_PRESET protected)
+    target_include_directories(model PRIVATE
+        "${{PROJECT_SOURCE_DIR}}/{args.source_dir}"{includes}
+        "${{VERISTAND_DIR}}")
+    target_compile_definitions(model PRIVATE kNIOSLinux)
+    target_compile_options(model PRIVATE
+        -W -Wall -pedantic -fno-builtin -fno-strict-aliasing)
+    target_link_libraries(model PRIVATE rt pthread m)
+
+    # host-only targets: the benchmark driver, the trace converter, and the
+    # performance check
+    if(NOT CMAKE_CROSSCOMPILING)
+        add_executable(vsmbench host/vsmbench.c)
+        target_include_directories(vsmbench PRIVATE "${{VERISTAND_DIR}}")
+        target_link_libraries(vsmbench PRIVATE ${{CMAKE_DL_LIBS}} m)
+
+        add_executable(vsmtrace host/vsmtrace.c)
+        target_link_libraries(vsmtrace PRIVATE pthread)
+
+        add_custom_target(perf-check
+            COMMAND vsmbench -n ${{VSM_PERF_TICKS}} -b ${{VSM_PERF_BUDGET_US}}
+                "$<TARGET_FILE:model>"
+            DEPENDS vsmbench model
+            USES_TERMINAL)
+
+        enable_testing()
+        add_test(NAME perf-check
+            COMMAND vsmbench -n ${{VSM_PERF_TICKS}} -b ${{VSM_PERF_BUDGET_US}}
+                "$<TARGET_FILE:model>")
+    endif()
+    """
+
+    cmakelists = textwrap.dedent(cmakelists).strip()
+    WriteOutput(outcmakelists, cmakelists)
+
+    cmakepresets = {
+        "version": 2,
+        "cmakeMinimumRequired": {"major": 3, "minor": 20, "patch": 0},
+        "configurePresets": [
+            {
+                "name": "nilrt",
+                "displayName": "NI Linux RT (x86_64)",
+                "description": "Cross-compile for VeriStand using NI's " +
+                        "toolchain (run from the environment set up by " +
+                        "Linux_64_GNU_Setup.bat)",
+                "generator": "Ninja",
+                "binaryDir": "${sourceDir}/build/nilrt",
+                "cacheVariables": {
+                    "CMAKE_BUILD_TYPE": "MinSizeRel",
+                    "CMAKE_TOOLCHAIN_FILE":
+                        "${sourceDir}/cmake/nilrt-toolchain.cmake",
+                },
+            },
+            {
+                "name": "host",
+                "displayName": "Host (gcc)",
+                "description": "Build the model and the benchmark driver " +
+                        "with the host gcc",
+                "generator": "Ninja",
+                "binaryDir": "${sourceDir}/build/host",
+                "cacheVariables": {
+                    "CMAKE_BUILD_TYPE": "Release",
+                    "CMAKE_C_COMPILER": "gcc",
+                    "CMAKE_CXX_COMPILER": "g++",
+                },
+            },
+        ],
+        "buildPresets": [
+            {"name": "nilrt", "configurePreset": "nilrt"},
+            {"name": "host", "configurePreset": "host"},
+        ],
+        "testPresets": [
+            {
+                "name": "host",
+                "configurePreset": "host",
+                "output": {"outputOnFailure": True},
+            },
+        ],
+    }
+
+    WriteOutput(outcmakepresets, json.dumps(cmakepresets, indent=2))
+
+    cmaketoolchain = f"""
+    # Auto-generated CMake toolchain file for NI Linux RT (x86_64).
+    #
+    # Generated {Timestamp()}
+    #
+    # Uses the compilers and sysroot set up by NI's Linux_64_GNU_Setup.bat
+    # (GCCSYSROOTPATH), which must be run before configuring.
+
+    set(CMAKE_SYSTEM_NAME Linux)
+    set(CMAKE_SYSTEM_PROCESSOR x86_64)
+
+    if(CMAKE_HOST_WIN32)
+        set(NILRT_EXE_SUFFIX .exe)
+    endif()
+
+    set(CMAKE_C_COMPILER x86_64-nilrt-linux-gcc${{NILRT_EXE_SUFFIX}})
+    set(CMAKE_CXX_COMPILER x86_64-nilrt-linux-g++${{NILRT_EXE_SUFFIX}})
+
+    if(DEFINED ENV{{GCCSYSROOTPATH}})
+        file(TO_CMAKE_PATH "$ENV{{GCCSYSROOTPATH}}" CMAKE_SYSROOT)
+    endif()
+
+    set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+    set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+    set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+    """
+
+    cmaketoolchain = textwrap.dedent(cmaketoolchain).strip()
+    WriteOutput(outcmaketoolchain, cmaketoolchain)
+
+    WriteOutput(outhostbench, Expand(FmtHostBench()))
+    WriteOutput(outhosttrace, Expand(FmtHostTrace()))
+
+if args.gen_log:
+    WriteOutput(outlogdecoder, textwrap.dedent(FmtLogDecoder()).strip())
+
+if len(args.depfile) > 0:
+    depinputs = [os.path.realpath(__file__)]
+    if args.config is not sys.stdin:
+        depinputs += [args.config.name]
+    depinputs += [path for (path, _) in modeldata["inputs"]]
+    if len(args.heat) > 0:
+        depinputs += [args.heat]
+    WriteDepfile(args.depfile, depinputs)
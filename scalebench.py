@@ -0,0 +1,275 @@
+#!/usr/bin/env python3
+
+# VeriStand C/C++ Model Generation Utility - scaling benchmark suite
+#
+# https://github.com/BloomyControls/vsmodelgen
+#
+# Copyright (c) 2022, Bloomy Controls
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice, this
+#    list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice,
+#    this list of conditions and the following disclaimer in the documentation
+#    and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from
+#    this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+# OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+# You may copy this script into your own projects, provided you retain the above
+# license.
+
+# Measures how the code generated by genvsmodel.py scales with the number of
+# channels. For each channel class and count, a config is synthesized, a model
+# with an empty step function is generated and built for the host with the
+# generated CMake project, and vsmbench measures it. The results are printed as
+# JSON.
+
+from datetime import datetime
+import argparse
+import json
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+CLASSES = ("ports", "signals", "parameters")
+COUNTS = (10, 100, 1000, 10000, 50000, 200000)
+
+# channels per category in the synthesized configs
+CATEGORY_SIZE = 100
+
+parser = argparse.ArgumentParser(
+        description="Measure how generated VeriStand models scale with the " +
+        "number of channels.",
+        usage='%(prog)s [options] --veristand-dir DIR')
+
+parser.add_argument("--veristand-dir", type=str, required=True, metavar='DIR',
+        dest="veristand_dir",
+        help="VeriStand model interface directory (ni_modelframework.h and " +
+        "custom/src/ni_modelframework.c)")
+parser.add_argument("--classes", type=str, default=",".join(CLASSES),
+        metavar='LIST',
+        help="comma-separated channel classes to scale (default: %(default)s)")
+parser.add_argument("--counts", type=str,
+        default=",".join([str(c) for c in COUNTS]), metavar='LIST',
+        help="comma-separated channel counts (default: %(default)s)")
+parser.add_argument('-n', "--ticks", type=int, default=10000, metavar='N',
+        help="ticks run by vsmbench for each model (default: %(default)s)")
+parser.add_argument('-j', "--jobs", type=int, default=os.cpu_count(),
+        metavar='N', help="parallel compile jobs (default: %(default)s)")
+parser.add_argument('-G', "--generator", type=str, default="", metavar='NAME',
+        help="CMake generator, overriding the host preset's Ninja")
+parser.add_argument("--gen-arg", type=str, action='append', default=[],
+        metavar='ARG', dest="gen_args",
+        help="extra genvsmodel.py argument (e.g. --gen-arg=--shards=8; may " +
+        "be specified multiple times)")
+parser.add_argument('-w', "--work-dir", type=str, default="", metavar='DIR',
+        dest="work_dir",
+        help="directory for the generated projects (default: a temporary " +
+        "directory, removed afterwards)")
+parser.add_argument('-o', "--output", type=str, default="", metavar='FILE',
+        help="write the results to FILE instead of stdout")
+parser.add_argument('-v', "--verbose", action='store_true',
+        help="print progress to stderr")
+
+args = parser.parse_args()
+
+def Vprint(*objects, sep=' ', end='\n'):
+    if args.verbose:
+        print("info:", *objects, sep=sep, end=end, file=sys.stderr, flush=True)
+
+def Die(*objects, code=1):
+    print("error:", *objects, file=sys.stderr, flush=True)
+    sys.exit(code)
+
+def SynthChannels(prefix: str, count: int, types: bool) -> list:
+    """
+    Synthesize scalar channels for a config, CATEGORY_SIZE to a category.
+
+    :param prefix: prefix of the category names
+    :param count: number of channels
+    :param types: whether to give the channels types (every fourth channel is
+    an i32, the rest are doubles)
+
+    :returns: a list of channel objects
+
+    """
+    channels = []
+    for k in range(count):
+        chan = {"name": f'{prefix}{k // CATEGORY_SIZE}.c{k % CATEGORY_SIZE}'}
+        if types:
+            chan["type"] = "i32" if k % 4 == 3 else "double"
+        channels += [chan]
+    return channels
+
+def SynthConfig(cls: str, count: int) -> dict:
+    """
+    Synthesize the config of a model with one class of channels.
+
+    :param cls: the channel class ("ports" for half inports and half outports,
+    "signals", or "parameters")
+    :param count: the number of channels
+
+    :returns: the config object
+
+    """
+    config = {
+            "name": f'scale_{cls}_{count}',
+            "builder": "vsmodelgen scaling benchmark",
+            "baserate": 0.001,
+            }
+
+    if cls == "ports":
+        config["inports"] = SynthChannels("in", (count + 1) // 2, False)
+        config["outports"] = SynthChannels("out", count // 2, False)
+    elif cls == "signals":
+        config["signals"] = SynthChannels("sig", count, True)
+    else:
+        config["parameters"] = SynthChannels("param", count, True)
+
+    return config
+
+def Run(cmd: list, cwd: str) -> float:
+    """
+    Run a command, failing if it fails.
+
+    :param cmd: the command and its arguments
+    :param cwd: the directory to run it in
+
+    :returns: the wall time taken, in seconds
+
+    """
+    Vprint(" ".join(cmd))
+    start = time.monotonic()
+    proc = subprocess.run(cmd, cwd=cwd, stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT, text=True)
+    elapsed = time.monotonic() - start
+    if proc.returncode != 0:
+        Die(f"{' '.join(cmd)} failed:\n{proc.stdout}")
+    return elapsed
+
+def Measure(cls: str, count: int, workdir: str) -> dict:
+    """
+    Generate, build, and benchmark one synthesized model.
+
+    :param cls: the channel class
+    :param count: the number of channels
+    :param workdir: the directory to create the project in
+
+    :returns: the results for the model
+
+    """
+    config = SynthConfig(cls, count)
+    name = config["name"]
+    projdir = os.path.join(workdir, name)
+    shutil.rmtree(projdir, ignore_errors=True)
+    os.makedirs(projdir)
+
+    configpath = os.path.join(projdir, "model.json")
+    with open(configpath, 'w') as f:
+        json.dump(config, f)
+
+    genvsmodel = os.path.join(os.path.dirname(os.path.realpath(__file__)),
+            "genvsmodel.py")
+    generate_s = Run([sys.executable, genvsmodel, "-r", projdir, "-O", "src",
+        "-f", "--cmake", "--impl"] + args.gen_args + [configpath], projdir)
+
+    configure = ["cmake", "--preset", "host",
+            f'-DVERISTAND_DIR={os.path.abspath(args.veristand_dir)}']
+    if len(args.generator) > 0:
+        configure += ["-G", args.generator]
+    Run(configure, projdir)
+
+    # only the model library is timed; the benchmark driver doesn't scale
+    build = ["cmake", "--build", "--preset", "host", "-j", str(args.jobs)]
+    compile_s = Run(build + ["--target", "model"], projdir)
+    Run(build + ["--target", "vsmbench"], projdir)
+
+    builddir = os.path.join(projdir, "build", "host")
+    lib = os.path.join(builddir, f'lib{name}64.so')
+    bench = subprocess.run([os.path.join(builddir, "vsmbench"), "-j", "-p",
+        "-s", "-n", str(args.ticks), lib], stdout=subprocess.PIPE, text=True)
+    if bench.returncode != 0:
+        Die(f"vsmbench failed for {name}")
+    results = json.loads(bench.stdout)
+
+    return {
+            "class": cls,
+            "channels": count,
+            "generate_s": round(generate_s, 3),
+            "compile_s": round(compile_s, 3),
+            "so_bytes": os.path.getsize(lib),
+            "init_us": results["init_us"],
+            "step_mean_us": results["step_mean_us"],
+            "step_p99_us": results["step_p99_us"],
+            "step_max_us": results["step_max_us"],
+            "get_elements": results["probe_elements"],
+            "get_element_ns": results["probe_element_ns"],
+            "set_elements": results["set_elements"],
+            "set_element_ns": results["set_element_ns"],
+            }
+
+classes = [c for c in args.classes.split(",") if len(c) > 0]
+for cls in classes:
+    if not cls in CLASSES:
+        Die(f"unknown channel class {cls} (expected one of " +
+                f"{', '.join(CLASSES)})")
+try:
+    counts = [int(c) for c in args.counts.split(",") if len(c) > 0]
+except ValueError:
+    Die("counts must be a comma-separated list of integers")
+if len(counts) == 0 or min(counts) < 1:
+    Die("counts must be at least 1")
+
+workdir = args.work_dir
+if len(workdir) == 0:
+    workdir = tempfile.mkdtemp(prefix="vsmscale")
+else:
+    os.makedirs(workdir, exist_ok=True)
+
+results = []
+try:
+    for cls in classes:
+        for count in counts:
+            Vprint(f"measuring {count} {cls}")
+            results += [Measure(cls, count, workdir)]
+finally:
+    if len(args.work_dir) == 0:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+report = {
+        "date": datetime.now().isoformat(timespec='seconds'),
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "cpus": os.cpu_count(),
+        "ticks": args.ticks,
+        "gen_args": args.gen_args,
+        "results": results,
+        }
+
+if len(args.output) > 0:
+    with open(args.output, 'w') as f:
+        json.dump(report, f, indent=2)
+        f.write('\n')
+else:
+    print(json.dumps(report, indent=2))